@@ -18,6 +18,8 @@
 #ifndef basecodec_h_INCLUDED
 #define basecodec_h_INCLUDED
 
+#include <cstdint>
+
 //
 // basecodec.h - functions for encoding and decoding bases
 //
@@ -80,6 +82,38 @@ inline char decode_comp_base(kmer_t kmer)
 }
 
 
+// base_quad_table - the lookup table of decode_base_quad, computed at
+//                   compile time
+//
+namespace basecodec_detail {
+
+struct base_quad_table {
+    char v[256][4];
+
+    constexpr base_quad_table() : v() {
+        for (unsigned i = 0; i != 256; ++i)
+            for (unsigned j = 0; j != 4; ++j)
+                v[i][j] = "acgt"[(i >> (6 - 2*j)) & 0x3];
+    }
+};
+
+} // namespace basecodec_detail
+
+// decode_base_quad - decode the four bases in the bottom byte of kmer
+//
+// - returns a pointer to the four bases (not NUL terminated), the base in
+//   the top two bits first, as a kmer holds them
+// - this lets decoders copy four bases per step rather than decode them
+//   one by one (see ss_decode_to in kmercodec.h)
+//
+template <typename kmer_t>
+inline const char* decode_base_quad(kmer_t kmer)
+{
+    constexpr static basecodec_detail::base_quad_table table;
+    return table.v[kmer & 0xFF];
+}
+
+
 } // namespace kfc
 
 #endif // basecodec_h_INCLUDED
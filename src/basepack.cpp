@@ -0,0 +1,350 @@
+/* basepack.cpp
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "basepack.h"
+#include "basecodec.h"
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KFC_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace kfc {
+
+
+// Every valid base has a distinct low nibble: A/a 1, C/c 3, G/g 7, T/t 4.
+// The vector kernels look up the low nibble of each character in two 16
+// byte tables, one giving its code, the other the upper case character that
+// must have that nibble.  The character is valid if, upper cased by clearing
+// bit 5, it equals the latter.  Unused nibbles hold 0xFF, which no upper
+// cased character can equal.
+
+static const std::uint8_t nibble_codes[16] = {
+    0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+static const std::uint8_t nibble_chars[16] = {
+    0xFF, 'A', 0xFF, 'C', 'T', 0xFF, 0xFF, 'G', 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+// scalar kernel -------------------------------------------------------
+
+static void
+pack_scalar(const char *p, size_t n, std::uint8_t *codes, std::uint64_t *mask)
+{
+    constexpr std::uint8_t X = 0xFF;
+
+    std::memset(mask, 0, ((n + 63) / 64) * sizeof(std::uint64_t));
+
+    for (size_t i = 0; i != n; ++i) {
+        std::uint8_t c = encode_base<std::uint8_t,X>(p[i]);
+        if (c == X) {
+            mask[i / 64] |= std::uint64_t(1) << (i % 64);
+            c = 0;
+        }
+        codes[i] = c;
+    }
+}
+
+#ifdef KFC_X86_KERNELS
+
+// sse4.2 kernel -------------------------------------------------------
+
+__attribute__((target("sse4.2")))
+static void
+pack_sse42(const char *p, size_t n, std::uint8_t *codes, std::uint64_t *mask)
+{
+    const __m128i tcodes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(nibble_codes));
+    const __m128i tchars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(nibble_chars));
+    const __m128i lo_nib = _mm_set1_epi8(0x0F);
+    const __m128i to_upper = _mm_set1_epi8(static_cast<char>(0xDF));
+
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        std::uint64_t m = 0;
+        for (unsigned j = 0; j != 64; j += 16) {
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + j));
+            __m128i nib = _mm_and_si128(c, lo_nib);
+            __m128i ok = _mm_cmpeq_epi8(_mm_and_si128(c, to_upper), _mm_shuffle_epi8(tchars, nib));
+            __m128i code = _mm_and_si128(_mm_shuffle_epi8(tcodes, nib), ok);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(codes + i + j), code);
+            m |= std::uint64_t(~_mm_movemask_epi8(ok) & 0xFFFF) << j;
+        }
+        mask[i / 64] = m;
+    }
+
+    if (i != n)
+        pack_scalar(p + i, n - i, codes + i, mask + i / 64);
+}
+
+// avx2 kernel ---------------------------------------------------------
+
+__attribute__((target("avx2")))
+static void
+pack_avx2(const char *p, size_t n, std::uint8_t *codes, std::uint64_t *mask)
+{
+    // vpshufb looks up within each 128-bit lane, so both lanes get the table
+
+    const __m256i tcodes = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(nibble_codes)));
+    const __m256i tchars = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(nibble_chars)));
+    const __m256i lo_nib = _mm256_set1_epi8(0x0F);
+    const __m256i to_upper = _mm256_set1_epi8(static_cast<char>(0xDF));
+
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        std::uint64_t m = 0;
+        for (unsigned j = 0; j != 64; j += 32) {
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + j));
+            __m256i nib = _mm256_and_si256(c, lo_nib);
+            __m256i ok = _mm256_cmpeq_epi8(_mm256_and_si256(c, to_upper), _mm256_shuffle_epi8(tchars, nib));
+            __m256i code = _mm256_and_si256(_mm256_shuffle_epi8(tcodes, nib), ok);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(codes + i + j), code);
+            m |= std::uint64_t(~static_cast<std::uint32_t>(_mm256_movemask_epi8(ok))) << j;
+        }
+        mask[i / 64] = m;
+    }
+
+    if (i != n)
+        pack_scalar(p + i, n - i, codes + i, mask + i / 64);
+}
+
+// avx-512bw kernel ----------------------------------------------------
+
+__attribute__((target("avx512bw")))
+static void
+pack_avx512bw(const char *p, size_t n, std::uint8_t *codes, std::uint64_t *mask)
+{
+    // one 64 byte vector is one mask word; the tail is done with masked
+    // loads and stores rather than a scalar loop
+
+    const __m512i tcodes = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i*>(nibble_codes)));
+    const __m512i tchars = _mm512_maskz_broadcast_i32x4(0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i*>(nibble_chars)));
+    const __m512i lo_nib = _mm512_set1_epi8(0x0F);
+    const __m512i to_upper = _mm512_set1_epi8(static_cast<char>(0xDF));
+
+    for (size_t i = 0; i < n; i += 64) {
+        __mmask64 live = n - i >= 64 ? ~__mmask64(0) : (__mmask64(1) << (n - i)) - 1;
+        __m512i c = _mm512_maskz_loadu_epi8(live, p + i);
+        __m512i nib = _mm512_and_si512(c, lo_nib);
+        __mmask64 ok = _mm512_cmpeq_epi8_mask(_mm512_and_si512(c, to_upper), _mm512_shuffle_epi8(tchars, nib));
+        _mm512_mask_storeu_epi8(codes + i, live, _mm512_maskz_shuffle_epi8(ok, tcodes, nib));
+        mask[i / 64] = ~ok & live;
+    }
+}
+
+#endif // KFC_X86_KERNELS
+
+// dispatch ------------------------------------------------------------
+
+bool
+pack_kernel_supported(pack_kernel k)
+{
+    switch (k) {
+        case pack_kernel::scalar: return true;
+#ifdef KFC_X86_KERNELS
+        case pack_kernel::sse42: return __builtin_cpu_supports("sse4.2");
+        case pack_kernel::avx2: return __builtin_cpu_supports("avx2");
+        case pack_kernel::avx512bw: return __builtin_cpu_supports("avx512bw");
+#endif
+        default: return false;
+    }
+}
+
+pack_kernel
+best_pack_kernel()
+{
+    for (pack_kernel k : { pack_kernel::avx512bw, pack_kernel::avx2, pack_kernel::sse42 })
+        if (pack_kernel_supported(k))
+            return k;
+
+    return pack_kernel::scalar;
+}
+
+const char *
+pack_kernel_name(pack_kernel k)
+{
+    switch (k) {
+        case pack_kernel::scalar: return "scalar";
+        case pack_kernel::sse42: return "sse4.2";
+        case pack_kernel::avx2: return "avx2";
+        case pack_kernel::avx512bw: return "avx512bw";
+    }
+    return "unknown";
+}
+
+pack_fn
+pack_function(pack_kernel k)
+{
+    if (!pack_kernel_supported(k))
+        raise_error("pack kernel %s not supported on this CPU", pack_kernel_name(k));
+
+    switch (k) {
+#ifdef KFC_X86_KERNELS
+        case pack_kernel::avx512bw: return pack_avx512bw;
+        case pack_kernel::avx2: return pack_avx2;
+        case pack_kernel::sse42: return pack_sse42;
+#endif
+        default: return pack_scalar;
+    }
+}
+
+void
+pack_bases(pack_kernel k, const char *p, size_t n, std::uint8_t *codes, std::uint64_t *mask)
+{
+    pack_function(k)(p, n, codes, mask);
+}
+
+void
+pack_bases(const char *p, size_t n, std::uint8_t *codes, std::uint64_t *mask)
+{
+    static const pack_fn best = pack_function(best_pack_kernel());
+    best(p, n, codes, mask);
+}
+
+// packed_dna ----------------------------------------------------------
+
+// squeeze 8 one-byte codes into 16 bits, the first code in the low bits
+
+static inline std::uint64_t
+squeeze8(const std::uint8_t *codes)
+{
+    std::uint64_t x;
+    std::memcpy(&x, codes, 8);
+
+    x = (x | (x >> 6)) & 0x000F000F000F000FUL;
+    x = (x | (x >> 12)) & 0x000000FF000000FFUL;
+    return (x | (x >> 24)) & 0xFFFFUL;
+}
+
+void
+packed_dna::assign(const char *p, size_t n)
+{
+    // convert in blocks that fit the stack, so the codes stay in cache
+
+    constexpr size_t block = 4096;
+
+    std::uint8_t codes[block];
+    std::uint64_t mask[block / 64];
+
+    size = n;
+    words.assign((n + 31) / 32, 0);
+    invalid.clear();
+
+    for (size_t b = 0; b < n; b += block) {
+        size_t len = n - b < block ? n - b : block;
+
+        pack_bases(p + b, len, codes, mask);
+
+        // zero the codes up to a multiple of 8 so we can squeeze them
+
+        size_t padded = (len + 7) & ~size_t(7);
+        std::memset(codes + len, 0, padded - len);
+
+        std::uint64_t *w = words.data() + b / 32;
+        for (size_t i = 0; i < padded; i += 8)
+            w[i / 32] |= squeeze8(codes + i) << (2 * (i % 32));
+
+        // collect the runs of set mask bits, joining runs across words
+        // and blocks
+
+        for (size_t i = 0; i < len; i += 64) {
+            std::uint64_t m = mask[i / 64];
+            while (m) {
+                unsigned lo = __builtin_ctzll(m);
+                std::uint64_t from_lo = m >> lo;
+                unsigned run_len = ~from_lo ? __builtin_ctzll(~from_lo) : 64 - lo;
+                size_t pos = b + i + lo;
+
+                if (!invalid.empty() && invalid.back().pos + invalid.back().len == pos)
+                    invalid.back().len += run_len;
+                else
+                    invalid.push_back(run { pos, run_len });
+
+                m = lo + run_len < 64 ? (m >> (lo + run_len)) << (lo + run_len) : 0;
+            }
+        }
+    }
+}
+
+void
+packed_dna::assign(const packed_dna& src, size_t pos, size_t len)
+{
+    if (pos > src.size || len > src.size - pos)
+        raise_error("programmer error: packed_dna range out of bounds");
+
+    size = len;
+    words.assign((len + 31) / 32, 0);
+    invalid.clear();
+
+    const std::uint64_t *w = src.words.data() + pos / 32;
+    unsigned shift = 2 * (pos % 32);
+    size_t n_src = src.words.size() - pos / 32;
+
+    for (size_t j = 0; j != words.size(); ++j) {
+        std::uint64_t v = w[j] >> shift;
+        if (shift && j + 1 < n_src)
+            v |= w[j + 1] << (64 - shift);
+        words[j] = v;
+    }
+
+    if (len % 32)
+        words.back() &= (std::uint64_t(1) << (2 * (len % 32))) - 1;
+
+    // the runs are sorted and disjoint, so only those from the first that
+    // ends beyond pos, up to the first that starts at pos+len, overlap
+
+    auto r = std::partition_point(src.invalid.begin(), src.invalid.end(),
+            [pos](const run& r) { return r.pos + r.len <= pos; });
+
+    for (; r != src.invalid.end() && r->pos < pos + len; ++r) {
+        size_t lo = r->pos > pos ? r->pos : pos;
+        size_t hi = r->pos + r->len < pos + len ? r->pos + r->len : pos + len;
+        if (lo < hi)
+            invalid.push_back(run { lo - pos, hi - lo });
+    }
+}
+
+void
+packed_dna::clear()
+{
+    size = 0;
+    words.clear();
+    invalid.clear();
+}
+
+std::string
+packed_dna::unpack() const
+{
+    std::string s(size, 'a');
+
+    for (size_t i = 0; i != size; ++i)
+        s[i] = "acgt"[(words[i / 32] >> (2 * (i % 32))) & 0x3];
+
+    for (const run& r : invalid)
+        s.replace(r.pos, r.len, r.len, 'n');
+
+    return s;
+}
+
+
+} // namespace kfc
+
+// vim: sts=4:sw=4:ai:si:et
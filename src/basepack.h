@@ -0,0 +1,162 @@
+/* basepack.h
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef basepack_h_INCLUDED
+#define basepack_h_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kfc {
+
+
+// pack_bases - convert DNA characters to base codes and an invalid mask
+//
+// Converts the n characters at p to base codes, one per byte in codes[0,n),
+// with the same values as encode_base (a=0, c=1, g=2, t=3, in either case).
+// For every character i that is not a valid base, sets bit i%64 in word
+// mask[i/64], and sets codes[i] to 0.  Array mask must have room for
+// (n+63)/64 words; bits beyond n in its last word are cleared.
+//
+// This pre-pass lets the rolling encoder (see ss_encode_packed in
+// kmercodec.h) do without a table lookup per base, and skip invalid base
+// handling for every 64 bases that have none.
+//
+// The work is done by a kernel that converts 16 (SSE4.2), 32 (AVX2) or 64
+// (AVX-512BW) characters at a time, using a nibble shuffle to look up both
+// the code and the expected character, or by a scalar table lookup where
+// these are not available.  By default the best kernel that the CPU supports
+// is used.
+//
+void pack_bases(const char *p, size_t n, std::uint8_t *codes, std::uint64_t *mask);
+
+// pack_kernel - the implementations of pack_bases, in order of preference
+//
+// All kernels are compiled into the binary, with the instruction set they
+// need enabled per function, so a single binary built without -march runs
+// on any x86-64 and picks the best kernel at runtime.  On other platforms
+// only the scalar kernel exists.
+//
+enum class pack_kernel { scalar, sse42, avx2, avx512bw };
+
+typedef void (*pack_fn)(const char*, size_t, std::uint8_t*, std::uint64_t*);
+
+// pack_function - the function that implements kernel k; raises an error
+//                 if the CPU (or platform) does not support the kernel
+pack_fn pack_function(pack_kernel k);
+
+// pack_bases - as above, but using kernel k
+void pack_bases(pack_kernel k, const char *p, size_t n, std::uint8_t *codes, std::uint64_t *mask);
+
+// best_pack_kernel - the best kernel the CPU we run on supports
+pack_kernel best_pack_kernel();
+
+// pack_kernel_supported - whether kernel k runs on this CPU
+bool pack_kernel_supported(pack_kernel k);
+
+// pack_kernel_name - the name of kernel k, as in the enum
+const char *pack_kernel_name(pack_kernel k);
+
+
+// packed_dna - DNA at 2 bits per base, plus the runs of invalid bases
+//
+// Holds size bases, 32 per word: base i is at bits 2*(i%32) of words[i/32],
+// counting from the least significant bit, with the codes of encode_base.
+// Invalid bases (anything but acgtACGT) are stored as code 0, and listed in
+// invalid as runs of consecutive invalid bases, in order of position.  Bits
+// beyond size in the last word are 0.
+//
+// This takes a quarter of the memory of the DNA string, and the rolling
+// encoders (see kmer_encoder) read it without validating every base again.
+// Because assign() finds the invalid runs with the pack_bases kernel, a run
+// of a million N's costs a few runs entries, and for_each_valid() lets the
+// counters skip it instead of encoding a million invalid k-mers.
+//
+struct packed_dna {
+
+    struct run {
+        size_t pos;
+        size_t len;
+    };
+
+    size_t size = 0;
+    std::vector<std::uint64_t> words;
+    std::vector<run> invalid;
+
+    // assign - pack the n characters at p
+    void assign(const char *p, size_t n);
+
+    // assign - copy the len bases starting at pos from src
+    void assign(const packed_dna& src, size_t pos, size_t len);
+
+    // clear - make empty, but keep the allocated memory
+    void clear();
+
+    // unpack - the DNA as a string of lower case bases, and 'n' for invalid
+    std::string unpack() const;
+
+    // for_each_valid - call f(lo, hi) for each stretch [lo,hi) in [pos,pos+n)
+    // that has no invalid bases and at least k bases, in order; returns the
+    // number of k-mers in these stretches, so that the other n-k+1 windows
+    // in [pos,pos+n) are the invalid k-mers
+    template <typename fn_t>
+    size_t for_each_valid(size_t pos, size_t n, size_t k, fn_t f) const;
+};
+
+
+// implementation ------------------------------------------------------------
+
+template <typename fn_t>
+size_t
+packed_dna::for_each_valid(size_t pos, size_t n, size_t k, fn_t f) const
+{
+    const size_t end = pos + n;
+    size_t n_valid = 0;
+
+    auto stretch = [&f, &n_valid, k](size_t lo, size_t hi) {
+        if (hi - lo >= k) {
+            f(lo, hi);
+            n_valid += hi - lo - k + 1;
+        }
+    };
+
+    // skip the runs that end before pos; the runs are in order
+
+    auto r = std::partition_point(invalid.begin(), invalid.end(),
+            [pos](const run& r) { return r.pos + r.len <= pos; });
+
+    size_t from = pos;
+    for (; r != invalid.end() && r->pos < end; ++r) {
+        if (r->pos > from)
+            stretch(from, r->pos);
+        from = r->pos + r->len;
+    }
+
+    if (from < end)
+        stretch(from, end);
+
+    return n_valid;
+}
+
+
+} // namespace kfc
+
+#endif // basepack_h_INCLUDED
+       // vim: sts=4:sw=4:ai:si:et
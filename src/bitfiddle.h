@@ -55,6 +55,25 @@ constexpr T flood_hibit(T t) {
     return signed_shr(t, bitsize<T>-1);
 }
 
+// byte_swap - return unsigned integral t with its bytes in reverse order
+//
+template <typename T>
+constexpr T byte_swap(T t) {
+    return sizeof(T) == 8 ? T(__builtin_bswap64(t)) :
+           sizeof(T) == 4 ? T(__builtin_bswap32(t)) :
+           sizeof(T) == 2 ? T(__builtin_bswap16(t)) : t;
+}
+
+// reverse_bitpairs - return unsigned integral t with its bit pairs in
+//                    reverse order, by swapping bytes, nibbles, and pairs
+//
+template <typename T>
+constexpr T reverse_bitpairs(T t) {
+    t = byte_swap(t);
+    t = ((t >> 4) & T(0x0F0F0F0F0F0F0F0FULL)) | ((t & T(0x0F0F0F0F0F0F0F0FULL)) << 4);
+    return ((t >> 2) & T(0x3333333333333333ULL)) | ((t & T(0x3333333333333333ULL)) << 2);
+}
+
 
 } // namespace kfc
 
@@ -0,0 +1,122 @@
+/* blockwriter.h
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef blockwriter_h_INCLUDED
+#define blockwriter_h_INCLUDED
+
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace kfc {
+
+
+// write_blocks - format output blocks on multiple threads, write them in order
+//
+// Calls fmt(i, buf) for every block i in [0,n_blocks), which must append the
+// text of block i to string buf, and writes the blocks to os in order of i.
+// The blocks are formatted in rounds of n_threads blocks, each on its own
+// thread and into its own buffer; after each round the buffers are written
+// out.  The output is therefore identical to formatting the blocks one after
+// the other, while memory use is bounded by n_threads times the block size.
+// The caller picks block sizes so that this is some megabytes per block.
+//
+template <typename fmt_fn>
+void write_blocks(std::ostream& os, size_t n_blocks, unsigned n_threads, fmt_fn fmt);
+
+
+// append_number - append the decimal representation of n to buf
+//
+// Does what os << n does for integral types, but without the ostream
+// overhead.  Other numeric types fall back to the ostream.
+//
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value>::type
+append_number(std::string& buf, T n)
+{
+    char digits[24];
+    char *p = digits + sizeof(digits);
+
+    typename std::make_unsigned<T>::type u = n;
+    bool neg = n < 0;
+    if (neg)
+        u = -u;
+
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+
+    if (neg)
+        *--p = '-';
+
+    buf.append(p, digits + sizeof(digits) - p);
+}
+
+template <typename T>
+inline typename std::enable_if<!std::is_integral<T>::value>::type
+append_number(std::string& buf, T n)
+{
+    std::ostringstream ss;
+    ss << n;
+    buf.append(ss.str());
+}
+
+
+// implementation ------------------------------------------------------------
+
+template <typename fmt_fn>
+void
+write_blocks(std::ostream& os, size_t n_blocks, unsigned n_threads, fmt_fn fmt)
+{
+    if (n_threads < 1)
+        n_threads = 1;
+
+    std::vector<std::string> bufs(n_threads);
+    std::vector<std::thread> threads;
+
+    for (size_t first = 0; first < n_blocks && os; first += n_threads) {
+
+        size_t n = n_blocks - first < n_threads ? n_blocks - first : n_threads;
+
+        for (size_t t = 1; t < n; ++t)
+            threads.emplace_back([&bufs, &fmt, first, t] {
+                    bufs[t].clear();
+                    fmt(first + t, bufs[t]);
+                });
+
+        bufs[0].clear();
+        fmt(first, bufs[0]);
+
+        for (auto& t : threads)
+            t.join();
+
+        threads.clear();
+
+        for (size_t t = 0; t < n; ++t)
+            os.write(bufs[t].data(), bufs[t].size());
+    }
+}
+
+
+} // namespace kfc
+
+#endif // blockwriter_h_INCLUDED
+       // vim: sts=4:sw=4:ai:si:et
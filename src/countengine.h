@@ -0,0 +1,265 @@
+/* countengine.h
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef countengine_h_INCLUDED
+#define countengine_h_INCLUDED
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include "basepack.h"
+#include "kmercodec.h"
+#include "kmercounter.h"
+#include "tallyman.h"
+#include "utils.h"
+
+namespace kfc {
+
+
+// kmer_counter_engine - kmer_counter_tally compiled for one configuration
+//
+// The generic kmer_counter_tally encodes through the function pointer of its
+// kmer_encoder, and tallies each block of k-mers through the virtual
+// tallyman::tally.  The engine is instantiated on the kmer_t, count_t, the
+// k-mer size, strandedness, and the concrete vector tallyman type, so that
+// its process() is a single loop in which the rolling encoder hands every
+// k-mer straight to the inline tally of the tallyman (its sink()).
+//
+// The engine always rolls single stranded.  For double strand counting it
+// rolls into a buffer of tally_block k-mers per thread, and canonicalises
+// the full buffer with the encoder's (vectorised) ss_to_ds_range before it
+// tallies it, which is faster than rolling both strands (see kmerencoder.h).
+//
+// When the tallyman is not concurrent and there are several threads, the
+// engine tallies each full buffer under the lock, so that the threads still
+// encode in parallel.  It also buffers when the tallyman's cells are too
+// large for the cache (its prefetches()), and then prefetches the cell of
+// the k-mer tally_prefetch_distance ahead as it tallies the buffer (see
+// tallyman.h).  Otherwise it rolls straight into the sink.
+//
+// The engine does not encode invalid k-mers at all.  It rolls over the
+// stretches of packed DNA between the invalid runs (see for_each_valid), and
+// adds the number of k-mers that overlap an invalid run to the invalid count
+// in one go.  Input strings are first packed, into a packed_dna that each
+// thread reuses.
+//
+// Results are written by kmer_counter_tally, which owns the tallyman.
+//
+template <typename kmer_t, typename count_t, unsigned ksize, bool sstrand, typename tman_t>
+class kmer_counter_engine : public kmer_counter_tally<kmer_t,count_t>
+{
+    private:
+        tman_t *tman_;
+        std::mutex mutex_;
+
+    public:
+        kmer_counter_engine(tman_t *tman, unsigned n_threads)
+            : kmer_counter_tally<kmer_t,count_t>(tman, ksize, sstrand, n_threads), tman_(tman) { }
+
+        virtual void process(const std::string& data);
+        virtual void process(std::string &&data);
+        virtual void process(const packed_dna& data);
+
+    private:
+        constexpr static size_t tally_block = 1UL << 13; // k-mers per locked tally
+
+        void count(const packed_dna& data);
+
+        template <typename sink_t>
+        size_t roll(const packed_dna& data, sink_t& sink);
+};
+
+
+// make_engine - create the kmer_counter_engine for 32-bit kmer_t
+//
+// Picks the instantiation for ksize and s_strand from a table per strand,
+// indexed by ksize, in the way kmerencoder.cpp picks its encoders.  Takes
+// ownership of tman.
+//
+template <typename count_t, typename tman_t>
+kmer_counter* make_engine(tman_t *tman, int ksize, bool s_strand, unsigned n_threads);
+
+
+// implementation ------------------------------------------------------------
+
+template <typename kmer_t, typename count_t, unsigned ksize, bool sstrand, typename tman_t>
+void
+kmer_counter_engine<kmer_t,count_t,ksize,sstrand,tman_t>::process(const std::string& data)
+{
+    thread_local packed_dna packed;
+
+    packed.assign(data.data(), data.size());
+    count(packed);
+}
+
+template <typename kmer_t, typename count_t, unsigned ksize, bool sstrand, typename tman_t>
+void
+kmer_counter_engine<kmer_t,count_t,ksize,sstrand,tman_t>::process(std::string &&data)
+{
+    process(static_cast<const std::string&>(data));
+}
+
+template <typename kmer_t, typename count_t, unsigned ksize, bool sstrand, typename tman_t>
+void
+kmer_counter_engine<kmer_t,count_t,ksize,sstrand,tman_t>::process(const packed_dna& data)
+{
+    count(data);
+}
+
+template <typename kmer_t, typename count_t, unsigned ksize, bool sstrand, typename tman_t>
+template <typename sink_t>
+size_t
+kmer_counter_engine<kmer_t,count_t,ksize,sstrand,tman_t>::roll(const packed_dna& data, sink_t& sink)
+{
+    const std::uint64_t *words = data.words.data();
+
+    // roll over the stretches between the invalid runs
+
+    return data.for_each_valid(0, data.size, ksize, [&sink, words](size_t lo, size_t hi) {
+        ss_roll_words<kmer_t,ksize>(words, lo, hi - lo, sink);
+    });
+}
+
+template <typename kmer_t, typename count_t, unsigned ksize, bool sstrand, typename tman_t>
+void
+kmer_counter_engine<kmer_t,count_t,ksize,sstrand,tman_t>::count(const packed_dna& data)
+{
+    if (data.size < ksize)
+        return;
+
+    size_t n_valid = 0;
+    bool concurrent = tman_->is_concurrent();
+    bool prefetch = tman_->prefetches();
+
+    if (sstrand && !prefetch && (concurrent || kmer_counter::n_threads_ < 2)) {
+        std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+        if (!concurrent)
+            lock.lock();
+        typename tman_t::sink_t sink = tman_->sink();
+        n_valid = roll(data, sink);
+    }
+    else {
+        thread_local std::vector<kmer_t> block(tally_block);
+        kmer_t *buf = block.data();
+        size_t n = 0;
+
+        auto flush = [this, buf, &n, concurrent, prefetch] {
+            if (!sstrand)
+                this->encoder().canonicalise(buf, buf + n);
+            std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+            if (!concurrent)
+                lock.lock();
+            typename tman_t::sink_t sink = tman_->sink();
+            size_t i = 0;
+            if (prefetch)
+                for (; i + tally_prefetch_distance < n; ++i) {
+                    sink.prefetch(buf[i + tally_prefetch_distance]);
+                    sink(buf[i]);
+                }
+            for (; i != n; ++i)
+                sink(buf[i]);
+            n = 0;
+        };
+
+        auto put = [buf, &n, &flush](kmer_t kmer) {
+            buf[n++] = kmer;
+            if (n == tally_block)
+                flush();
+        };
+
+        n_valid = roll(data, put);
+
+        if (n)
+            flush();
+    }
+
+    size_t n_invalid = data.size - ksize + 1 - n_valid;
+    if (n_invalid) {
+        std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+        if (!tman_->is_concurrent())
+            lock.lock();
+        tman_->add_invalid(n_invalid);
+    }
+}
+
+namespace engine_detail {
+
+template <typename count_t, typename tman_t, unsigned ksize, bool sstrand>
+kmer_counter*
+create(tman_t *tman, unsigned n_threads)
+{
+    return new kmer_counter_engine<std::uint32_t,count_t,ksize,sstrand,tman_t>(tman, n_threads);
+}
+
+} // namespace engine_detail
+
+template <typename count_t, typename tman_t>
+kmer_counter*
+make_engine(tman_t *tman, int ksize, bool s_strand, unsigned n_threads)
+{
+    using engine_detail::create;
+
+    typedef kmer_counter* (*create_fn)(tman_t*, unsigned);
+
+    static const create_fn ss_create[16] = {
+        0,
+        create<count_t,tman_t,1,true>,
+        create<count_t,tman_t,2,true>,
+        create<count_t,tman_t,3,true>,
+        create<count_t,tman_t,4,true>,
+        create<count_t,tman_t,5,true>,
+        create<count_t,tman_t,6,true>,
+        create<count_t,tman_t,7,true>,
+        create<count_t,tman_t,8,true>,
+        create<count_t,tman_t,9,true>,
+        create<count_t,tman_t,10,true>,
+        create<count_t,tman_t,11,true>,
+        create<count_t,tman_t,12,true>,
+        create<count_t,tman_t,13,true>,
+        create<count_t,tman_t,14,true>,
+        create<count_t,tman_t,15,true>
+    };
+
+    static const create_fn ds_create[16] = {
+        0, create<count_t,tman_t,1,false>,
+        0, create<count_t,tman_t,3,false>,
+        0, create<count_t,tman_t,5,false>,
+        0, create<count_t,tman_t,7,false>,
+        0, create<count_t,tman_t,9,false>,
+        0, create<count_t,tman_t,11,false>,
+        0, create<count_t,tman_t,13,false>,
+        0, create<count_t,tman_t,15,false>
+    };
+
+    if (ksize < 1 || ksize > 15)
+        raise_error("k-mer size %d out of range for counting engine", ksize);
+
+    create_fn fn = s_strand ? ss_create[ksize] : ds_create[ksize];
+
+    if (!fn)
+        raise_error("k-mer size must be odd for double-stranded encoding");
+
+    verbose_emit("counting engine compiled for ksize %d, %s strand", ksize, s_strand ? "single" : "double");
+
+    return fn(tman, n_threads);
+}
+
+
+} // namespace kfc
+
+#endif // countengine_h_INCLUDED
+       // vim: sts=4:sw=4:ai:si:et
@@ -18,6 +18,7 @@
 #ifndef implpicker_h_INCLUDED
 #define implpicker_h_INCLUDED
 
+#include "countengine.h"
 #include "kmercounter.h"
 
 namespace kfc {
@@ -29,13 +30,14 @@ namespace kfc {
 // an instance of kmer_counter which is optimal given a set of parameters
 // and constraints.  The caller gets ownership of the kmer_counter.
 //
-// Implementations: Vector, Map, List
+// Implementations: Vector, Map, Hash, List
 //
-// We currently have three kmer_counter implementations: two based on tallying
+// We currently have four kmer_counter implementations: three based on tallying
 // the encoded k-mers as they are being processed, of which one uses a vector
-// of tallies indexed by the k-mer number and one uses a map of kmer->tally
-// pairs, and one which does not tally but collects the list of k-mer numbers
-// as-is, then sorts this list when results are requested.[1]
+// of tallies indexed by the k-mer number (or a compact vector of byte cells),
+// one uses a map of kmer->tally pairs, and one an open addressing hash table
+// of kmer->tally pairs, and one which does not tally but collects the list of
+// k-mer numbers as-is, then sorts this list when results are requested.[1]
 //
 // Parameters: K and C (and S)
 //
@@ -65,7 +67,17 @@ namespace kfc {
 // mostly benefits the list implementation.  Though in all cases the encoding
 // (from string to k-mer numbers) can take place on separate threads[2], in
 // the tallying implementations there is contention for the map or vector, as
-// these need mutex access whenever a tally takes place.
+// these need mutex access whenever a tally takes place.  Therefore, when T > 1
+// we use tallyman_vec_atomic, whose cells take lock-free atomic increments from
+// all threads, and tallyman_map_sharded, which splits the map in 2^S shards
+// (S chosen so there are at least 4T) that each have their own lock.  When T
+// copies of the vector fit comfortably in memory (that is: T*mem(Q) is at most
+// a quarter of M, which is the case for small K), then we rather give each
+// thread a private vector in tallyman_vec_private, and sum these at the end.
+//
+// On a single thread, a vector of 64MB or more (B >= 24 with 32-bit count_t)
+// is a tallyman_vec_blocked, which partitions the k-mers on their high bits
+// and tallies them one cache-sized region of the vector at a time.
 //
 // Types: kmer_t, count_t
 //
@@ -111,11 +123,29 @@ namespace kfc {
 // * vector: very sensitive to K, not at all to L
 //   - L < 32: mem(Q) = 4*2^(2K-!S) = 2^(2K+2-!S)
 //   - L >=32: mem(Q) = 8*2^(2K-!S) = 2^(2K+3-!S)
-// * list: factor 4 on L, possible 2 on K, but cost of sorting
+// * list: factor 4 on L, possible 2 on K, but cost of sorting (an in-place
+//   radix sort over 2K-!S bits, parallel on T threads)
 //   - K <=15: mem(C) = 4*C = 2^(2+L)
 //   - K > 15: mem(C) = 8*C = 2^(3+L)
-// * map: factor 8-24 on L, marginal to K
-//   - see output of map_entry_size for actual figures
+// * map: factor 48-64 on L, marginal to K
+//   - see output of map_entry_size for actual figures, which include the
+//     red-black tree node and the allocator overhead
+// * hash: factor 8-16 (the entry) times 1.4-2.9 (the load) times 1.5 (the
+//   old table while growing) on D, the number of distinct k-mers; we don't
+//   know D, but it is at most min(C,Q)
+//   - see output of hash_table_bytes for actual figures
+//
+// * compact vector: 1 byte per k-mer, so a quarter (or eighth) of the vector,
+//   plus a hash of the few k-mers whose count exceeds 255
+//   - mem(Q) = 2^(2K-!S)
+//
+// The compact vector stands in for the vector when the vector does not fit in
+// M but the compact vector does.  At K=15 and !S this takes 512MB not 2GB.
+//
+// The hash tallies in O(1) without the pointer chasing of the map, and sorts
+// just its D entries at the end, where the list sorts all C k-mers.  As it
+// takes a lock per tally block, we pick it when the vector is large, the
+// hash fits in M, and T = 1.
 //
 // --- FOOTNOTES
 //
@@ -124,46 +154,130 @@ namespace kfc {
 //     sorts their ksize substrings into a separate index.  This would be more
 //     generic as the input could be in any alphabet.
 // [2] Or even on the GPU.
-// [3] A special case would be binary counting: yes/no presence of each k-mer.
-//     This could happen in a bit-vector.
+// [3] A special case is binary counting: yes/no presence of each k-mer, in a
+//     bit vector (tallyman_bits).  With two bits per k-mer, it also tells
+//     which k-mers occur once, twice, or three times or more.  These are not
+//     picked, but requested (as implementations '1' and '2'), as they do not
+//     give the actual counts.  At K=15 and !S, they take 64MB resp. 128MB.
 //
 // ----------------------------------------------------------------------------
 
 
+// map_shard_bits - helper computes the number of map shards for nt threads
+//
+static unsigned
+map_shard_bits(unsigned nt)
+{
+    unsigned bits = 0;
+    while (bits < 12 && (1U << bits) < 4 * nt)
+        ++bits;
+    return bits;
+}
+
+
 // make_instance - helper to produce the actual implementation
 //
+// Vector tallies of 32-bit k-mers get a counting engine compiled for their
+// k-mer size and strandedness (see countengine.h); the others, whose vector
+// would take 16GB or more, and the map and list, use the generic classes.
+//
 static kmer_counter*
-make_instance(char impl, bool big_kmer, bool big_count, int ks, bool ss, size_t nk)
+make_instance(char impl, bool big_kmer, bool big_count, int ks, bool ss, size_t nk, unsigned nt)
 {
     typedef std::uint32_t u32;
     typedef std::uint64_t u64;
 
     size_t kb = 2*ks-(ss?0:1);
 
-    verbose_emit("kmer_counter instance: impl %c, ksize %d, kbits %lu, max_count %lu, kmer_t %d, count_t %d",
-            impl, ks, kb, nk, big_kmer?64:32, big_count?64:32) ;
+    // with multiple threads, vector and map must take concurrent tallies
+
+    if (impl == 'v' && nt > 1)
+        impl = 'a';
+    else if (impl == 'm' && nt > 1)
+        impl = 's';
+
+    unsigned sb = map_shard_bits(nt);
+
+    verbose_emit("kmer_counter instance: impl %c, ksize %d, kbits %lu, max_count %lu, kmer_t %d, count_t %d, threads %u",
+            impl, ks, kb, nk, big_kmer?64:32, big_count?64:32, nt) ;
 
     switch (impl) {
         case 'v':
             return big_kmer
                 ? big_count
-                    ? (kmer_counter*) new kmer_counter_tally<u64,u64>(new tallyman_vec<u64,u64>(kb), ks, ss)
-                    : (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_vec<u64,u32>(kb), ks, ss)
+                    ? (kmer_counter*) new kmer_counter_tally<u64,u64>(new tallyman_vec<u64,u64>(kb), ks, ss, nt)
+                    : (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_vec<u64,u32>(kb), ks, ss, nt)
+                : big_count
+                    ? make_engine<u64>(new tallyman_vec<u32,u64>(kb), ks, ss, nt)
+                    : make_engine<u32>(new tallyman_vec<u32,u32>(kb), ks, ss, nt);
+        case 'b':
+            return big_kmer
+                ? big_count
+                    ? (kmer_counter*) new kmer_counter_tally<u64,u64>(new tallyman_vec_blocked<u64,u64>(kb), ks, ss, nt)
+                    : (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_vec_blocked<u64,u32>(kb), ks, ss, nt)
+                : big_count
+                    ? make_engine<u64>(new tallyman_vec_blocked<u32,u64>(kb), ks, ss, nt)
+                    : make_engine<u32>(new tallyman_vec_blocked<u32,u32>(kb), ks, ss, nt);
+        case 'c':
+            return big_kmer
+                ? big_count
+                    ? (kmer_counter*) new kmer_counter_tally<u64,u64>(new tallyman_vec_compact<u64,u64>(kb), ks, ss, nt)
+                    : (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_vec_compact<u64,u32>(kb), ks, ss, nt)
                 : big_count
-                    ? (kmer_counter*) new kmer_counter_tally<u32,u64>(new tallyman_vec<u32,u64>(kb), ks, ss)
-                    : (kmer_counter*) new kmer_counter_tally<u32,u32>(new tallyman_vec<u32,u32>(kb), ks, ss);
+                    ? make_engine<u64>(new tallyman_vec_compact<u32,u64>(kb), ks, ss, nt)
+                    : make_engine<u32>(new tallyman_vec_compact<u32,u32>(kb), ks, ss, nt);
+        case '1':
+            return big_kmer
+                ? (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_bits<u64,u32,1>(kb), ks, ss, nt)
+                : make_engine<u32>(new tallyman_bits<u32,u32,1>(kb), ks, ss, nt);
+        case '2':
+            return big_kmer
+                ? (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_bits<u64,u32,2>(kb), ks, ss, nt)
+                : make_engine<u32>(new tallyman_bits<u32,u32,2>(kb), ks, ss, nt);
+        case 'a':
+            return big_kmer
+                ? big_count
+                    ? (kmer_counter*) new kmer_counter_tally<u64,u64>(new tallyman_vec_atomic<u64,u64>(kb), ks, ss, nt)
+                    : (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_vec_atomic<u64,u32>(kb), ks, ss, nt)
+                : big_count
+                    ? make_engine<u64>(new tallyman_vec_atomic<u32,u64>(kb), ks, ss, nt)
+                    : make_engine<u32>(new tallyman_vec_atomic<u32,u32>(kb), ks, ss, nt);
         case 'm':
             return big_kmer
                 ? big_count
-                    ? (kmer_counter*) new kmer_counter_tally<u64,u64>(new tallyman_map<u64,u64>(kb), ks, ss)
-                    : (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_map<u64,u32>(kb), ks, ss)
+                    ? (kmer_counter*) new kmer_counter_tally<u64,u64>(new tallyman_map<u64,u64>(kb), ks, ss, nt)
+                    : (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_map<u64,u32>(kb), ks, ss, nt)
                 : big_count
-                    ? (kmer_counter*) new kmer_counter_tally<u32,u64>(new tallyman_map<u32,u64>(kb), ks, ss)
-                    : (kmer_counter*) new kmer_counter_tally<u32,u32>(new tallyman_map<u32,u32>(kb), ks, ss);
+                    ? (kmer_counter*) new kmer_counter_tally<u32,u64>(new tallyman_map<u32,u64>(kb), ks, ss, nt)
+                    : (kmer_counter*) new kmer_counter_tally<u32,u32>(new tallyman_map<u32,u32>(kb), ks, ss, nt);
+        case 's':
+            return big_kmer
+                ? big_count
+                    ? (kmer_counter*) new kmer_counter_tally<u64,u64>(new tallyman_map_sharded<u64,u64>(kb, sb), ks, ss, nt)
+                    : (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_map_sharded<u64,u32>(kb, sb), ks, ss, nt)
+                : big_count
+                    ? (kmer_counter*) new kmer_counter_tally<u32,u64>(new tallyman_map_sharded<u32,u64>(kb, sb), ks, ss, nt)
+                    : (kmer_counter*) new kmer_counter_tally<u32,u32>(new tallyman_map_sharded<u32,u32>(kb, sb), ks, ss, nt);
+        case 'p':
+            return big_kmer
+                ? big_count
+                    ? (kmer_counter*) new kmer_counter_tally<u64,u64>(new tallyman_vec_private<u64,u64>(kb, nt), ks, ss, nt)
+                    : (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_vec_private<u64,u32>(kb, nt), ks, ss, nt)
+                : big_count
+                    ? make_engine<u64>(new tallyman_vec_private<u32,u64>(kb, nt), ks, ss, nt)
+                    : make_engine<u32>(new tallyman_vec_private<u32,u32>(kb, nt), ks, ss, nt);
+        case 'h':
+            return big_kmer
+                ? big_count
+                    ? (kmer_counter*) new kmer_counter_tally<u64,u64>(new tallyman_hash<u64,u64>(kb), ks, ss, nt)
+                    : (kmer_counter*) new kmer_counter_tally<u64,u32>(new tallyman_hash<u64,u32>(kb), ks, ss, nt)
+                : big_count
+                    ? (kmer_counter*) new kmer_counter_tally<u32,u64>(new tallyman_hash<u32,u64>(kb), ks, ss, nt)
+                    : (kmer_counter*) new kmer_counter_tally<u32,u32>(new tallyman_hash<u32,u32>(kb), ks, ss, nt);
         case 'l':
             return big_kmer
-                    ? (kmer_counter*) new kmer_counter_list<u64>(ks, ss, nk)
-                    : (kmer_counter*) new kmer_counter_list<u32>(ks, ss, nk);
+                    ? (kmer_counter*) new kmer_counter_list<u64>(ks, ss, nk, nt)
+                    : (kmer_counter*) new kmer_counter_list<u32>(ks, ss, nk, nt);
         default:
             raise_error("invalid implementation option: %c", impl);
             return 0;
@@ -173,6 +287,18 @@ make_instance(char impl, bool big_kmer, bool big_count, int ks, bool ss, size_t
 
 // map_entry_size - helper computes the memory usage of map implementation
 //
+// A std::map entry is a red-black tree node: colour and three pointers (32
+// bytes on 64-bit), then the value_type.  The allocator adds its 8 byte
+// header and rounds the chunk up to 16 bytes.
+//
+template <typename kmer_t, typename count_t>
+static size_t
+map_node_size()
+{
+    size_t node = 4 * sizeof(void*) + sizeof(typename std::map<kmer_t,count_t>::value_type);
+    return (node + sizeof(void*) + 15) & ~static_cast<size_t>(15);
+}
+
 static size_t
 map_entry_size(bool big_kmer, bool big_count)
 {
@@ -181,9 +307,27 @@ map_entry_size(bool big_kmer, bool big_count)
 
     return big_kmer
         ? big_count
-            ? sizeof(std::map<u64,u64>::value_type) : sizeof(std::map<u64,u32>::value_type)
+            ? map_node_size<u64,u64>() : map_node_size<u64,u32>()
+        : big_count
+            ? map_node_size<u32,u64>() : map_node_size<u32,u32>();
+}
+
+
+// hash_table_bytes - helper computes the memory usage of hash implementation
+//
+// Gives the peak bytes of a tallyman_hash that holds n distinct k-mers.
+//
+static size_t
+hash_table_bytes(bool big_kmer, bool big_count, size_t n)
+{
+    typedef std::uint32_t u32;
+    typedef std::uint64_t u64;
+
+    return big_kmer
+        ? big_count
+            ? tallyman_hash<u64,u64>::table_bytes(n) : tallyman_hash<u64,u32>::table_bytes(n)
         : big_count
-            ? sizeof(std::map<u32,u64>::value_type) : sizeof(std::map<u32,u32>::value_type);
+            ? tallyman_hash<u32,u64>::table_bytes(n) : tallyman_hash<u32,u32>::table_bytes(n);
 }
 
 
@@ -197,13 +341,15 @@ pick_implementation(
         bool s_strand,          // single strand encoding
         unsigned max_mbp,       // maximum number of bases in millions
         unsigned max_gb,        // maximum memory use in GB
-        char force_impl)        // force vector, list, map implementation: 'v', 'l', 'm'
+        char force_impl,        // force vector, list, map, hash, compact: 'v', 'l', 'm', 'h', 'c',
+                                // or presence or saturating 2-bit tally: '1', '2'
+        unsigned n_threads = 1) // number of threads that will be calling process()
 {
     bool big_kmer = false;
     bool big_count = false;
     size_t max_mb = 0;
     size_t max_count = 0;
-    size_t sz_vec = 0, sz_lst = 0, sz_map = 0;
+    size_t sz_vec = 0, sz_lst = 0, sz_map = 0, sz_hash = 0;
     size_t cap_count_lst = 0, cap_count_map = 0;
     unsigned k_bits = 2 * ksize - (s_strand ? 0 : 1);
 
@@ -263,6 +409,46 @@ pick_implementation(
     sz_vec = (big_count ? 8 : 4) * (1UL << (k_bits > 20 ? k_bits - 20 : 0));
     verbose_emit("vector implementation requires %luMB", sz_vec);
 
+        // if the vector does not fit, but one of byte cells does (leaving
+        // room for its overflow), then use the compact vector, and from here
+        // on consider it the vector
+
+    char vec_impl = 'v';
+
+    size_t sz_cvec = 1UL << (k_bits > 20 ? k_bits - 20 : 0);
+
+    auto sz_bits = [k_bits](unsigned cell_bits) -> size_t {
+        return k_bits > 23 ? cell_bits << (k_bits - 23) : 1;
+    };
+
+    if (sz_vec > max_mb && sz_cvec < max_mb) {
+        verbose_emit("vector does not fit, compact vector (%luMB) does", sz_cvec);
+        vec_impl = 'c';
+        sz_vec = sz_cvec;
+    }
+
+        // with multiple threads, use private vectors if these fit comfortably,
+        // else a single vector with atomic increments
+
+    if (vec_impl == 'c') {
+        if (n_threads > 1)
+            verbose_emit("compact vector is tallied under a lock per block on %u threads", n_threads);
+    }
+    else if (n_threads == 1) { // with threads, 'p' and 'a' tally without a lock
+        if (sz_vec >= 64) {
+            verbose_emit("vector exceeds cache, tallying it a region at a time");
+            vec_impl = 'b';
+        }
+    }
+    else {
+        if (n_threads * sz_vec <= max_mb / 4) {
+            verbose_emit("private vectors for %u threads fit (%luMB)", n_threads, n_threads * sz_vec);
+            vec_impl = 'p';
+        }
+        else
+            vec_impl = 'a';
+    }
+
         // determine memory consumption of the other impls
 
     if (max_mbp) {
@@ -274,9 +460,16 @@ pick_implementation(
         if (sz_map == 0) sz_map = 1;
         verbose_emit("map implementation requires %luMB", sz_map);
 
+            // the hash holds at most min(C,Q) distinct k-mers
+
+        size_t max_distinct = k_bits < 63 && (1UL << k_bits) < max_count ? 1UL << k_bits : max_count;
+        sz_hash = hash_table_bytes(big_kmer, big_count, max_distinct) >> 20;
+        if (sz_hash == 0) sz_hash = 1;
+        verbose_emit("hash implementation requires at most %luMB", sz_hash);
+
             // if user specified max_mbp AND max_gb, then bail out if nothing fits
 
-        if (max_gb && sz_vec > max_mb && sz_map > max_mb && sz_lst > max_mb)
+        if (max_gb && sz_vec > max_mb && sz_map > max_mb && sz_lst > max_mb && sz_hash > max_mb)
             raise_error("no implementation can count %uM k-mers in %uGB memory", max_mbp, max_gb);
     }
     else {
@@ -302,33 +495,45 @@ pick_implementation(
             raise_error("requested list implementation cannot count %luM k-mers in %UGB memory", max_mbp, max_gb);
         else if (force_impl == 'm' && max_gb && max_mbp && sz_map > max_mb)
             raise_error("requested map implementation cannot count %luM k-mers in %UGB memory", max_mbp, max_gb);
+        else if (force_impl == 'h' && max_gb && max_mbp && sz_hash > max_mb)
+            raise_error("requested hash implementation cannot count %luM k-mers in %UGB memory", max_mbp, max_gb);
+        else if (force_impl == 'c' && max_gb && sz_cvec >= max_mb)
+            raise_error("requested compact vector implementation does not fit in %uGB memory", max_gb);
+        else if ((force_impl == '1' || force_impl == '2') && max_gb && sz_bits(force_impl - '0') > max_mb)
+            raise_error("requested bit vector implementation does not fit in %uGB memory", max_gb);
 
         verbose_emit("user-specified kmer_counter implementation: %c", force_impl);
-        return make_instance(force_impl, big_kmer, big_count, ksize, s_strand, max_count);
+        return make_instance(force_impl == 'v' ? vec_impl : force_impl, big_kmer, big_count, ksize, s_strand, max_count, n_threads);
     }
 
         // now we can pick the implementation
 
     if (sz_vec <= 512) { // if within half a GB, just go for the vector
         verbose_emit("vector implementation small (%luMB), picking it", sz_vec);
-        return make_instance('v', big_kmer, big_count, ksize, s_strand, max_count);
+        return make_instance(vec_impl, big_kmer, big_count, ksize, s_strand, max_count, n_threads);
     }
     else if (sz_lst != 0) { // we know the size the list would have
         if (sz_lst < 512) {
             verbose_emit("list implementation small (%luMB), picking it", sz_lst);
-            return make_instance('l', big_kmer, big_count, ksize, s_strand, max_count);
+            return make_instance('l', big_kmer, big_count, ksize, s_strand, max_count, n_threads);
+        }
+        else if (sz_hash < sz_vec && sz_hash <= max_mb) {
+            verbose_emit("hash implementation (%luMB) smaller than vector (%luMB) and fits memory", sz_hash, sz_vec);
+            if (n_threads > 1)
+                verbose_emit("hash is tallied under a lock per block on %u threads", n_threads);
+            return make_instance('h', big_kmer, big_count, ksize, s_strand, max_count, n_threads);
         }
         else if (sz_vec < sz_lst) {
             verbose_emit("vector implementation (%luMB) smaller than list (%luMB)", sz_vec, sz_lst);
             if (sz_vec > max_mb)
                 emit("expect trashing: insufficient physical memory (%luMB)", max_mb);
-            return make_instance('v', big_kmer, big_count, ksize, s_strand, max_count);
+            return make_instance(vec_impl, big_kmer, big_count, ksize, s_strand, max_count, n_threads);
         }
         else {
             verbose_emit("list implementation (%luMB) smaller than vector (%luMB)", sz_lst, sz_vec);
             if (sz_lst > max_mb)
                 emit("expect trashing: insufficient physical memory (%luMB)", max_mb);
-            return make_instance('l', big_kmer, big_count, ksize, s_strand, max_count);
+            return make_instance('l', big_kmer, big_count, ksize, s_strand, max_count, n_threads);
         }
     }
     else { // we don't know the count size
@@ -336,11 +541,11 @@ pick_implementation(
 
         if (sz_vec < max_mb) { // vec fits but list may be faster, notify user
             verbose_emit("picking vector implementation (%luMB) as it fits memory (%u), and count size is unknown", sz_vec, max_gb);
-            return make_instance('v', big_kmer, big_count, ksize, s_strand, max_count);
+            return make_instance(vec_impl, big_kmer, big_count, ksize, s_strand, max_count, n_threads);
         }
         else { // vec impossible, need to choose between map or list, lets take list and hope the best
             verbose_emit("picking list implementation as vector would exceed memory, and count size is unknown");
-            return make_instance('l', big_kmer, big_count, ksize, s_strand, max_count);
+            return make_instance('l', big_kmer, big_count, ksize, s_strand, max_count, n_threads);
         }
     }
 }
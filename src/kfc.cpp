@@ -21,6 +21,7 @@
 #include <string>
 
 #include "implpicker.h"
+#include "pipeline.h"
 #include "seqreader.h"
 #include "utils.h"
 
@@ -43,12 +44,16 @@ static const char USAGE[] = "\n"
 "   -q        suppress output headers, just show k-mers and counts\n"
 "   -l MBASE  limit counting capacity to MBASE million bases (optimises speed)\n"
 "   -m MEMGB  constrain memory use to about MEM GB (default: all minus 2GB)\n"
-"   -x l|v|m  override the implementation choice to be list, vector, or map\n"
+"   -x IMPL   override the implementation choice: l(ist), v(ector), m(ap), h(ash),\n"
+"             c(ompact vector of byte counters)\n"
+"   -b        binary counting: only record presence, output count 1 (1 bit per k-mer)\n"
+"   -c        capped counting: output counts 1, 2, and 3 for 3 or more (2 bits per k-mer)\n"
+"   -t NUM    number of counting threads (default: all available cores)\n"
 "   -v        produce verbose output to stderr\n"
 "\n"
 "  Each FILE can be an (optionally gzipped) FASTA, FASTQ, or plain DNA file.  If\n"
-"  FILE is omitted or '-', input is read from stdin.  With gzipped input, note\n"
-"  that 'gunzip | kfc' is often fastest (due to multiprocessing).\n"
+"  FILE is omitted or '-', input is read from stdin.  Input is read on a single\n"
+"  thread; with gzipped input, 'gunzip | kfc' may therefore still be faster.\n"
 "\n"
 "  Only k-mers consisting of proper bases (acgtACGT) are counted.  All k-mers\n"
 "  containing other letters are counted as invalid.\n"
@@ -70,6 +75,13 @@ static const char USAGE[] = "\n"
 "  count in the output (with DNA sequence \"XXX..\").  By default the invalid\n"
 "  count is printed to standard error).\n"
 "\n"
+"  Options -b and -c take precedence over -x, and need far less memory than the\n"
+"  vector of counts: at k=15, 64MB resp. 128MB (double the size with -s).\n"
+"\n"
+"  With -t 1, a vector of counts larger than the cache is tallied a region at\n"
+"  a time; with more threads, each thread gets its own vector if these fit,\n"
+"  else the threads share one vector.\n"
+"\n"
 "  More information: http://io.zwets.it/kfc.\n"
 "\n";
 
@@ -88,7 +100,8 @@ int main (int, char *argv[])
     unsigned max_mbp = 0.0;
     unsigned max_gb = 0;
     char force_impl = '\0';
-    int n_threads = 0;
+    char bits_impl = '\0';
+    unsigned n_threads = 0;
     unsigned o_opts = output_opts::none;
 
     set_progname("kfc");
@@ -121,6 +134,12 @@ int main (int, char *argv[])
         else if (opt == 'q') {
             o_opts |= output_opts::no_headers;
         }
+        else if (opt == 'b') {
+            bits_impl = '1';
+        }
+        else if (opt == 'c') {
+            bits_impl = '2';
+        }
         // subsequent options require an argument
         else if (!*++argv) {
             usage_exit();
@@ -138,9 +157,15 @@ int main (int, char *argv[])
             if ((max_gb = std::atoi(*argv)) < 1)
                 raise_error("invalid memory size: %s", *argv);
         }
+        else if (opt == 't') {
+            int n = std::atoi(*argv);
+            if (n < 1)
+                raise_error("invalid number of threads: %s", *argv);
+            n_threads = n;
+        }
         else if (opt == 'x') {
             switch (force_impl = *argv[0]) {
-                case 'l': case 'v': case 'm': break;
+                case 'l': case 'v': case 'm': case 'h': case 'c': break;
                 default: raise_error("invalid implementation: %c", force_impl);
             }
         }
@@ -148,11 +173,23 @@ int main (int, char *argv[])
             usage_exit();
     }
 
+    if (!n_threads)
+        n_threads = get_system_threads();
+
+    if (bits_impl)
+        force_impl = bits_impl;
+
         // Create the kmer_counter via the pick_implementation method
 
-    std::unique_ptr<kmer_counter> counter(pick_implementation(ksize, single_strand, max_mbp, max_gb, force_impl));
+    std::unique_ptr<kmer_counter> counter(pick_implementation(ksize, single_strand, max_mbp, max_gb, force_impl, n_threads));
+
+        // Set up the pipeline that feeds the counter on n_threads
+
+    counting_pipeline pipeline(*counter, n_threads);
 
-        // Iterate over files
+        // Iterate over files, packing as we read (see packed_dna)
+
+    verbose_emit("packing input with the %s kernel", pack_kernel_name(best_pack_kernel()));
 
     std::string fname(*argv ? *argv++ : "-");
 
@@ -170,10 +207,12 @@ int main (int, char *argv[])
         }
 
         sequence_reader reader(*is);
+        reader.set_chunking(counting_pipeline::chunk_bases, ksize - 1);
+        reader.set_packing(true);
         sequence seq;
 
         while (reader.next(seq))
-            counter->process(std::move(seq.data));
+            pipeline.process(std::move(seq.packed));
 
         in_file.close();
 
@@ -181,7 +220,9 @@ int main (int, char *argv[])
 
     } while (!fname.empty());
 
-        // Output kmer_counter results
+        // Wait for the counting threads to finish, then output results
+
+    pipeline.finish();
 
     counter->write_results(std::cout, o_opts);
 
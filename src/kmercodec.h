@@ -18,6 +18,10 @@
 #ifndef kmercodec_h_INCLUDED
 #define kmercodec_h_INCLUDED
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include "basecodec.h"
 #include "bitfiddle.h"
 
@@ -112,9 +116,12 @@ ss_encode(const char *p0, const char *p1, kmer_t *t)
 //
 // - returns the reverse complement of single-strand encoded kmer,
 //   or an arbitrary number with high bit set if the input had it too
+// - complements all bits, reverses the bit pairs of the whole word (a byte
+//   swap and two swaps within the bytes), then shifts the kmer down; this
+//   is branch and loop free, so vectorises in ss_to_ds_range
 //
 template <typename kmer_t, unsigned ksize>
-kmer_t
+inline kmer_t
 ss_revcomp(kmer_t in)
 {
     static_assert(std::is_unsigned<kmer_t>::value,
@@ -124,16 +131,7 @@ ss_revcomp(kmer_t in)
     static_assert(ksize & 1,
             "template argument ksize must be odd for double strand encoding");
 
-    kmer_t out = 0;
-
-    in ^= low_bits<kmer_t,2*ksize>;
-
-    // reverse by shifting bitpairs from in to out
-    for (unsigned i = 0; i < ksize; ++i) {
-        out <<= 2;
-        out |= (in & 0x3);
-        in = signed_shr(in, 2);  // need to retain the high bit
-    }
+    kmer_t out = reverse_bitpairs<kmer_t>(~in) >> (bitsize<kmer_t> - 2*ksize);
 
     // return result but set its error bit if it was set on in 
     return out | (in & high_bit<kmer_t>);
@@ -171,11 +169,49 @@ ss_decode(kmer_t kmer, bool rc = false)
 }
 
 
+// ss_decode_to - decode kmer to dna in a caller provided buffer
+//
+// - writes the ksize bases of kmer, or of its reverse complement if rc, to
+//   p[0,ksize), or ksize 'X' if kmer is invalid; returns p + ksize
+// - copies four bases per byte of the kmer from the decode_base_quad table,
+//   back to front, so costs ceil(ksize/4) steps and no allocation
+//
+template <typename kmer_t, unsigned ksize>
+char*
+ss_decode_to(kmer_t kmer, char *p, bool rc = false)
+{
+    static_assert(std::is_unsigned<kmer_t>::value,
+            "template argument kmer_t must be unsigned integral");
+    static_assert(0 < ksize && ksize < 4*sizeof(kmer_t),
+            "template argument ksize must be in range [1,bitsize/2)");
+
+    if (kmer & high_bit<kmer_t>) {
+        std::memset(p, 'X', ksize);
+        return p + ksize;
+    }
+
+    if (rc)
+        kmer = reverse_bitpairs<kmer_t>(~kmer) >> (bitsize<kmer_t> - 2*ksize);
+
+    char *q = p + ksize;
+
+    for (; q - p >= 4; kmer >>= 8) {
+        q -= 4;
+        std::memcpy(q, decode_base_quad(kmer), 4);
+    }
+
+    if (q != p)
+        std::memcpy(p, decode_base_quad(kmer) + 4 - (q - p), q - p);
+
+    return p + ksize;
+}
+
+
 // ss_to_ds - convert ss-encoded kmer to ds-encoded kmer,
 //            reverse complementing if needed
 //
 template <typename kmer_t, unsigned ksize>
-kmer_t
+inline kmer_t
 ss_to_ds(kmer_t kmer)
 {
     static_assert(ksize & 1,
@@ -183,12 +219,32 @@ ss_to_ds(kmer_t kmer)
 
     constexpr kmer_t half_mask = low_bits<kmer_t,ksize>;
 
-    kmer_t out = ((kmer>>ksize) & 0x1) ? ss_revcomp<kmer_t,ksize>(kmer) : kmer;
+    // select the revcomp when the middle base is g or t, without branching
+
+    kmer_t take_rc = -((kmer >> ksize) & 0x1);
+    kmer_t out = (ss_revcomp<kmer_t,ksize>(kmer) & take_rc) | (kmer & ~take_rc);
+
+    // drop the high bit of the middle base
 
     return ((out & (half_mask << ksize)) >> 1) | (out & (high_bit<kmer_t> | half_mask));
 }
 
 
+// ss_to_ds_range - convert the ss-encoded kmers in [p,e) to ds in place
+//
+// - this is the batch canonicalisation kernel: ss_to_ds has no branches or
+//   loops, so the compiler vectorises this loop for the target it is built
+//   for (see kmerencoder.cpp, which builds it for AVX2 too)
+//
+template <typename kmer_t, unsigned ksize>
+inline void
+ss_to_ds_range(kmer_t *p, kmer_t *e)
+{
+    for (; p != e; ++p)
+        *p = ss_to_ds<kmer_t,ksize>(*p);
+}
+
+
 // --- ds encode ---------------------------------------------------------
 
 
@@ -264,6 +320,9 @@ ds_encode_one(const char *p0)
 // - p1 must point one beyond end of string, and at least at p0+ksize
 // - t must point at an array of n (= p1-p0-ksize+1) kmer_t, to receive
 //   encoded valid kmers, or values with high bit set to mark invalid
+// - kfc makes double strand kmers with a single strand encode or roll and
+//   ss_to_ds_range; this one base at a time version is kept as the
+//   reference that the unit tests check against
 //
 template <typename kmer_t, unsigned ksize>
 void
@@ -284,17 +343,210 @@ ds_encode(const char *p0, const char *p1, kmer_t *t)
 
     for (kmer_t *pt = t; pt != t + (p1 - ksize + 1 - p0); ++pt)
         *pt = ss_to_ds<kmer_t,ksize>(*pt);
-#else
+#elif 0
     // IMPLEMENTATION 2: use encode_kmer_ds in turn
     const char *p = p0;
     while (p != p1 - ksize + 1)
         *t++ = ds_encode_one<kmer_t,ksize>(p++);
-// #else
-    // IMPLEMENTATION 3: write rolling encode
+#else
+    // IMPLEMENTATION 3: rolling encode
+    //
+    // We roll each base into both the forward kmer, exactly as ss_encode
+    // does (so including its invalid base handling), and the reverse
+    // complement kmer, at its top end.  The middle base then selects which
+    // of the two to output, as in ds_encode_one, after dropping its high
+    // bit (which is zero in the selected kmer).  The reverse complement
+    // needs no invalid handling: it is valid whenever the forward kmer is.
+
+    constexpr static kmer_t invalid_value = high_bits<kmer_t,2*ksize>;
+    constexpr static kmer_t half_mask = low_bits<kmer_t,ksize>;
+
+    kmer_t fwd = 0;
+    kmer_t rev = 0;
+
+    auto roll = [&fwd, &rev](char c) {
+        kmer_t new_base = encode_base<kmer_t,invalid_value>(c);
+        // clear bits of the outgoing base if current kmer is good
+        fwd &= signed_shr<kmer_t>(fwd|~high_bit<kmer_t>, bitsize<kmer_t>-2*ksize+1);
+        // make place for the new base, clear all if it is invalid
+        fwd <<= 2;
+        fwd &= ~flood_hibit<kmer_t>(new_base);
+        // or in the new base or invalid value with ksize high bits
+        fwd |= new_base;
+        // the complement of the new base enters the top of the revcomp
+        rev >>= 2;
+        rev |= ((new_base & 0x3) ^ 0x3) << (2*ksize-2);
+    };
+
+    const char *p = p0;
+
+    // we need to fill the kmer before we can output it
+
+    while (p != p0 + ksize - 1)
+        roll(*p++);
+
+    while (p != p1) {
+        roll(*p++);
+        // middle base g or t (high bit set) means we take the revcomp
+        kmer_t sel = ((fwd >> ksize) & 0x1) ? rev : fwd;
+        *t++ = ((sel & (half_mask << ksize)) >> 1) | (sel & half_mask) | (fwd & high_bit<kmer_t>);
+    }
 #endif
 }
 
 
+// --- packed encode -----------------------------------------------------
+//
+// The packed encoders take their input as produced by pack_bases (see
+// basepack.h): codes[0,n) holds the 2-bit code of every base, and bit i of
+// the mask words is set when base i was invalid.  They write the same valid
+// kmers as their unpacked counterparts, and an arbitrary value with its high
+// bit set for every kmer that has an invalid base.
+//
+// Rather than flooding the kmer with invalid bits, they count down the
+// number of kmers still covering the last invalid base.  For every 64 bases
+// without invalid ones (by far the common case), the loop reduces to the
+// bare shift and or.
+
+
+// ss_encode_packed - single-strand encode packed bases to sequence of kmers
+//
+// - n must be at least ksize; t must have room for n-ksize+1 kmer_t
+//
+template <typename kmer_t, unsigned ksize>
+void
+ss_encode_packed(const std::uint8_t *codes, const std::uint64_t *mask, size_t n, kmer_t *t)
+{
+    static_assert(std::is_unsigned<kmer_t>::value,
+            "template argument kmer_t must be unsigned integral");
+    static_assert(0 < ksize && ksize < 4*sizeof(kmer_t),
+            "template argument ksize must be in range [1,bitsize/2)");
+
+    constexpr static kmer_t kmer_mask = low_bits<kmer_t,2*ksize>;
+
+    kmer_t kmer = 0;
+    unsigned bad = 0;   // number of kmers yet to output that have an invalid base
+    size_t i = 0;
+
+    // we need to fill the kmer before we can output it
+
+    for (; i != ksize - 1; ++i) {
+        kmer = (kmer << 2) | codes[i];
+        if ((mask[i / 64] >> (i % 64)) & 1)
+            bad = ksize - 1;    // as its first kmer is the one at i
+        else if (bad)
+            --bad;
+    }
+
+    while (i != n) {
+        size_t end = (i | 63) + 1 < n ? (i | 63) + 1 : n;
+        std::uint64_t m = mask[i / 64] >> (i % 64);
+
+        if (!m && !bad)
+            for (; i != end; ++i) {
+                kmer = ((kmer << 2) | codes[i]) & kmer_mask;
+                *t++ = kmer;
+            }
+        else
+            for (; i != end; ++i, m >>= 1) {
+                kmer = ((kmer << 2) | codes[i]) & kmer_mask;
+                if (m & 1)
+                    bad = ksize;
+                *t++ = bad ? kmer | high_bit<kmer_t> : kmer;
+                if (bad)
+                    --bad;
+            }
+    }
+}
+
+
+// --- 2-bit word encode -------------------------------------------------
+//
+// The word encoders take 2-bit packed DNA (see packed_dna in basepack.h):
+// base i at bits 2*(i%32) of words[i/32].  They encode every kmer as if all
+// bases were valid, as packed_dna stores invalid bases as code 0 and lists
+// them separately; mark_invalid_runs then flags the kmers that overlap them.
+//
+// The roll functions do the work: they pass every kmer to sink(kmer), which
+// the compiler inlines, so that callers can consume the kmers in the loop
+// (see countengine.h) rather than through memory.
+
+
+// ss_roll_words - single-strand roll over 2-bit packed bases, sinking each kmer
+//
+// - rolls over the n bases starting at base pos, n must be at least ksize
+//
+template <typename kmer_t, unsigned ksize, typename sink_t>
+inline void
+ss_roll_words(const std::uint64_t *words, size_t pos, size_t n, sink_t& sink)
+{
+    static_assert(std::is_unsigned<kmer_t>::value,
+            "template argument kmer_t must be unsigned integral");
+    static_assert(0 < ksize && ksize < 4*sizeof(kmer_t),
+            "template argument ksize must be in range [1,bitsize/2)");
+
+    constexpr static kmer_t kmer_mask = low_bits<kmer_t,2*ksize>;
+
+    kmer_t kmer = 0;
+    size_t i = pos;
+
+    n += pos;
+
+    for (; i != pos + ksize - 1; ++i)
+        kmer = (kmer << 2) | ((words[i / 32] >> (2 * (i % 32))) & 0x3);
+
+    while (i != n) {
+        size_t end = (i | 31) + 1 < n ? (i | 31) + 1 : n;
+        std::uint64_t w = words[i / 32] >> (2 * (i % 32));
+
+        for (; i != end; ++i, w >>= 2) {
+            kmer = ((kmer << 2) | (w & 0x3)) & kmer_mask;
+            sink(kmer);
+        }
+    }
+}
+
+
+// ss_encode_words - single-strand encode 2-bit packed bases to sequence of kmers
+//
+// - encodes the n bases starting at base pos
+// - n must be at least ksize; t must have room for n-ksize+1 kmer_t
+//
+template <typename kmer_t, unsigned ksize>
+void
+ss_encode_words(const std::uint64_t *words, size_t pos, size_t n, kmer_t *t)
+{
+    auto sink = [&t](kmer_t kmer) { *t++ = kmer; };
+    ss_roll_words<kmer_t,ksize>(words, pos, n, sink);
+}
+
+
+// mark_invalid_runs - set the high bit on the kmers that overlap invalid runs
+//
+// - t holds the n-ksize+1 kmers of the n bases starting at base pos
+// - [begin,end) are runs with members pos and len, the positions of the
+//   invalid bases, in order of position; runs outside the bases are skipped
+//
+template <typename kmer_t, typename run_iter>
+void
+mark_invalid_runs(run_iter begin, run_iter end, size_t pos, size_t n, unsigned ksize, kmer_t *t)
+{
+    size_t n_kmers = n - ksize + 1;
+
+    // skip to the first run that ends after pos
+
+    begin = std::partition_point(begin, end,
+            [pos](const auto& r) { return r.pos + r.len <= pos; });
+
+    for (; begin != end && begin->pos < pos + n; ++begin) {
+        size_t lo = begin->pos < pos + ksize - 1 ? 0 : begin->pos - pos + 1 - ksize;
+        size_t hi = begin->pos + begin->len - pos < n_kmers ? begin->pos + begin->len - pos : n_kmers;
+        for (size_t i = lo; i < hi; ++i)
+            t[i] |= high_bit<kmer_t>;
+    }
+}
+
+
 // ds_decode ----------------------------------------------------------
 //
 template <typename kmer_t, unsigned ksize>
@@ -346,6 +598,25 @@ ds_decode(kmer_t kmer, bool rc = false)
 }
 
 
+// ds_decode_to - decode ds kmer to dna in a caller provided buffer
+//
+// - as ss_decode_to; a ds kmer is its ss kmer less the (zero) high bit of
+//   the middle base, so this puts that bit back and decodes single stranded
+//
+template <typename kmer_t, unsigned ksize>
+char*
+ds_decode_to(kmer_t kmer, char *p, bool rc = false)
+{
+    static_assert(ksize & 1,
+            "template argument ksize must be odd for double strand encoding");
+
+    constexpr static kmer_t half_mask = low_bits<kmer_t,ksize>;
+
+    kmer_t ss = kmer & high_bit<kmer_t> ? kmer : ((kmer & ~half_mask) << 1) | (kmer & half_mask);
+    return ss_decode_to<kmer_t,ksize>(ss, p, rc);
+}
+
+
 } // namespace kfc
 
 #endif // kmercodec_h_INCLUDED
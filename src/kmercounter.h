@@ -21,9 +21,13 @@
 #include <string>
 #include <ostream>
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <algorithm>
 #include "tallyman.h"
 #include "kmerencoder.h"
+#include "radixsort.h"
+#include "blockwriter.h"
 
 namespace kfc {
 
@@ -67,21 +71,36 @@ enum output_opts : unsigned {
 // implementation class (vector, map, or list).  Actual performance is hard to
 // predict. @TODO@ add guidelines.
 //
+// The n_threads parameter is the number of threads the implementation may
+// use for its own work, such as sorting the k-mer list in write_results(),
+// and formatting the output lines (see blockwriter.h).
+//
+// The process() member may be invoked concurrently from multiple threads,
+// which is what the counting_pipeline (see pipeline.h) does.  Encoding always
+// happens in parallel; the tally implementation serialises only the (brief)
+// tallying, and not even that when the tallyman is concurrent.  The list
+// implementation reserves its slice of the list with an atomic add.  The
+// write_results() member must not be invoked until all process() calls have
+// returned.
+//
 class kmer_counter
 {
     protected:
         int ksize_;
         bool s_strand_;
+        unsigned n_threads_;
 
     public:
-        kmer_counter(int ksize, bool s_strand);
+        kmer_counter(int ksize, bool s_strand, unsigned n_threads = 1);
         virtual ~kmer_counter() { }
 
         int ksize() const { return ksize_; }
         bool single_strand() const { return s_strand_; }
+        unsigned n_threads() const { return n_threads_; }
 
         virtual void process(const std::string& data) = 0;
         virtual void process(std::string &&data) = 0;
+        virtual void process(const packed_dna& data) = 0;
         virtual std::ostream& write_results(std::ostream& os, unsigned = output_opts::none) const = 0;
 };
 
@@ -89,8 +108,18 @@ class kmer_counter
 // kmer_counter_tally ----------------------------------------------------------
 //
 // Implements kmer_counter by keeping a tally for every kmer.  The tally counter
-// has two possible implementations: a vector with an entry for every possible
-// value of kmer_t, or a map whose keys are k-mers and values are counts.
+// has four possible implementations: a vector with an entry for every possible
+// value of kmer_t, a compact vector of small cells that overflow into a hash
+// (or of 1 or 2-bit cells that saturate), a (possibly sharded) map whose keys
+// are k-mers and values are counts, or a hash table of k-mers and counts that
+// is sorted at the end.
+//
+// The process() members encode a sequence in blocks of encode_block k-mers,
+// into a buffer that each thread reuses, and tally each block while it is in
+// cache.  This does not allocate per sequence, nor pass over a sequence's
+// k-mers twice.  Strings are packed first (see packed_dna), and only the
+// stretches between runs of invalid bases are encoded; the k-mers that
+// overlap an invalid base are added to the invalid count in one go.
 
 template <typename kmer_t, typename count_t>
 class kmer_counter_tally : public kmer_counter
@@ -106,20 +135,38 @@ class kmer_counter_tally : public kmer_counter
     private:
         std::unique_ptr<tallyman<kmer_t,count_t>> tallyman_;
         kmer_encoder<kmer_t> encoder_;
+        std::mutex tally_mutex_;
+        bool lock_tally_;
 
     public:
-	kmer_counter_tally(tallyman<kmer_t,count_t>*, int ksize, bool s_strand);
+	kmer_counter_tally(tallyman<kmer_t,count_t>*, int ksize, bool s_strand, unsigned n_threads = 1);
         kmer_counter_tally(const kmer_counter_tally<kmer_t,count_t>&) = delete;
         kmer_counter_tally& operator=(const kmer_counter_tally<kmer_t,count_t>&) = delete;
         virtual ~kmer_counter_tally() { }
 
         virtual void process(const std::string& data);
         virtual void process(std::string &&data);
+        virtual void process(const packed_dna& data);
         virtual std::ostream& write_results(std::ostream& os, unsigned = output_opts::none) const;
 
+        const tallyman<kmer_t,count_t>* get_tallyman() const { return tallyman_.get(); }
+
+    protected:
+        const kmer_encoder<kmer_t>& encoder() const { return encoder_; }
+
     private:
+        void tally_block(const kmer_t *begin, const kmer_t *end);
+        void add_invalid(count_t n);
         void write_vec_results(std::ostream&, const count_t*, const count_t*, bool dna, bool zeros) const;
+        void write_compact_results(std::ostream&, bool dna, bool zeros) const;
+        void append_vec_range(std::string& buf, size_t lo, const count_t *counts, size_t n, bool dna, bool zeros) const;
         void write_map_results(std::ostream&, bool dna, bool zeros) const;
+        void write_hash_results(std::ostream&, bool dna, bool zeros) const;
+
+        static kmer_t *block_buffer();
+
+        constexpr static size_t encode_block = 1UL << 13; // k-mers per encode block
+        constexpr static size_t block_kmers = 1UL << 20;  // k-mers per output block
 };
 
 
@@ -127,7 +174,11 @@ class kmer_counter_tally : public kmer_counter
 //
 // This implementation does not keep tallies but instead keeps the list of kmers
 // as they are coming in.  When write_results is called, the list is sorted and
-// the counted kmers are output.
+// the counted kmers are output.  Concurrent process() calls each claim a slice
+// of the list by atomically bumping the cursor, then encode into it in parallel.
+// The list is sorted with a parallel radix sort on n_threads (see radixsort.h).
+// Only valid k-mers are stored: process() encodes the stretches between runs
+// of invalid bases (see packed_dna), and just counts the k-mers it skips.
 
 template <typename kmer_t>
 class kmer_counter_list : public kmer_counter
@@ -139,47 +190,117 @@ class kmer_counter_list : public kmer_counter
         constexpr static int max_ksize = kmer_encoder<kmer_t>::max_ksize;
 
     private:
-        kmer_t *kmers_, *pkmers_cur_, *pkmers_end_;
+        kmer_t *kmers_, *pkmers_end_;
+        std::atomic<kmer_t*> pkmers_cur_;
+        std::atomic<std::uint64_t> n_invalid_;
         kmer_encoder<kmer_t> encoder_;
 
     public:
-	kmer_counter_list(int ksize, bool s_strand, size_t max_count);
+	kmer_counter_list(int ksize, bool s_strand, size_t max_count, unsigned n_threads = 1);
         kmer_counter_list(const kmer_counter_list<kmer_t>&) = delete;
         kmer_counter_list& operator=(const kmer_counter_list<kmer_t>&) = delete;
         virtual ~kmer_counter_list();
 
         virtual void process(const std::string& data);
         virtual void process(std::string &&data);
+        virtual void process(const packed_dna& data);
         virtual std::ostream& write_results(std::ostream& os, unsigned = output_opts::none) const;
+
+    private:
+        void write_range(std::string& buf, const kmer_t *p, const kmer_t *pend,
+                std::uint64_t lo, std::uint64_t hi, bool dna, bool zeros) const;
+
+        constexpr static size_t block_kmers = 1UL << 20;  // k-mers per output block
 };
 
 // kmer_counter_tally methods --------------------------------------------------
 
 template <typename kmer_t,typename count_t>
 kmer_counter_tally<kmer_t,count_t>::kmer_counter_tally(
-        tallyman<kmer_t,count_t>* tman, int ksize, bool s_strand)
-    : kmer_counter(ksize, s_strand),
+        tallyman<kmer_t,count_t>* tman, int ksize, bool s_strand, unsigned n_threads)
+    : kmer_counter(ksize, s_strand, n_threads),
       tallyman_(tman),
-      encoder_(ksize, s_strand)
+      encoder_(ksize, s_strand),
+      lock_tally_(!tman->is_concurrent())
 {
     if (ksize > max_ksize)
         raise_error("k-mer size %d too large for this impl (max %d)", ksize, max_ksize);
 }
 
+template <typename kmer_t,typename count_t>
+kmer_t*
+kmer_counter_tally<kmer_t,count_t>::block_buffer()
+{
+    thread_local std::vector<kmer_t> buf(encode_block);
+    return buf.data();
+}
+
+template <typename kmer_t,typename count_t>
+inline void
+kmer_counter_tally<kmer_t,count_t>::tally_block(const kmer_t *begin, const kmer_t *end)
+{
+    if (lock_tally_) {
+        std::lock_guard<std::mutex> lock(tally_mutex_);
+        tallyman_->tally(begin, end);
+    }
+    else
+        tallyman_->tally(begin, end);
+}
+
+template <typename kmer_t,typename count_t>
+void
+kmer_counter_tally<kmer_t,count_t>::add_invalid(count_t n)
+{
+    if (lock_tally_) {
+        std::lock_guard<std::mutex> lock(tally_mutex_);
+        tallyman_->add_invalid(n);
+    }
+    else
+        tallyman_->add_invalid(n);
+}
+
 template <typename kmer_t,typename count_t>
 void
 kmer_counter_tally<kmer_t,count_t>::process(const std::string& data)
 {
-    std::vector<kmer_t> kmers = encoder_.encode(data);
-    tallyman_->tally(kmers);
+    thread_local packed_dna packed;
+
+    packed.assign(data.data(), data.size());
+    process(packed);
 }
 
 template <typename kmer_t,typename count_t>
 void
 kmer_counter_tally<kmer_t,count_t>::process(std::string &&data)
 {
-    std::vector<kmer_t> kmers = encoder_.encode(data);
-    tallyman_->tally(kmers);
+    process(static_cast<const std::string&>(data));
+}
+
+template <typename kmer_t,typename count_t>
+void
+kmer_counter_tally<kmer_t,count_t>::process(const packed_dna& data)
+{
+    const size_t n = data.size;
+    const size_t k = ksize_;
+    kmer_t *buf = block_buffer();
+
+    if (n < k)
+        return;
+
+    // encode the stretches between the invalid runs in blocks that overlap
+    // by k-1 bases, so no k-mer is missed; the invalid k-mers are not
+    // encoded, only counted
+
+    size_t n_valid = data.for_each_valid(0, n, k, [this, &data, buf, k](size_t lo, size_t hi) {
+        for (size_t pos = lo; pos + k <= hi; pos += encode_block) {
+            size_t len = hi - pos < encode_block + k - 1 ? hi - pos : encode_block + k - 1;
+            encoder_.encode(data, pos, len, buf);
+            tally_block(buf, buf + len - k + 1);
+        }
+    });
+
+    if (n_valid != n - k + 1)
+        add_invalid(n - k + 1 - n_valid);
 }
 
 template <typename kmer_t, typename count_t>
@@ -196,12 +317,19 @@ kmer_counter_tally<kmer_t, count_t>::write_results(std::ostream &os, unsigned op
 
     int k = kmer_counter::ksize_;
     bool s = kmer_counter::s_strand_;
+
+    tallyman_->finish();
     count_t n_invalid = tallyman_->invalid_count();
+    count_t cap = tallyman_->count_cap();
 
     if (do_headers) {
         // Line 1
         os << "# kfc " << k << "-mer counts "
             << (s ? "(single strand directional)": "(canonical, destranded)" );
+        if (cap == 1)
+            os << "; presence only, 1 means present";
+        else if (cap)
+            os << "; capped, " << cap << " means " << cap << " or more";
         if (!do_invalid && n_invalid) // if !do_invalid then show in header
             os << "; excluding " << n_invalid << " invalid k-mers";
         if (!do_zeros)
@@ -217,6 +345,12 @@ kmer_counter_tally<kmer_t, count_t>::write_results(std::ostream &os, unsigned op
         const count_t *data = tallyman_->get_results_vec();
         write_vec_results(os, data, data + tallyman_->max_value() + 1, do_dna, do_zeros);
     }
+    else if (tallyman_->is_hash()) {
+        write_hash_results(os, do_dna, do_zeros);
+    }
+    else if (tallyman_->is_compact()) {
+        write_compact_results(os, do_dna, do_zeros);
+    }
     else {
         write_map_results(os, do_dna, do_zeros);
     }
@@ -237,15 +371,54 @@ template <typename kmer_t, typename count_t>
 void
 kmer_counter_tally<kmer_t, count_t>::write_vec_results(std::ostream &os, const count_t *pdata, const count_t *pend, bool dna, bool zeros) const
 {
-    const count_t *p = pdata - 1;
-    kmer_t kmer = 0;
-    while (++p != pend) {
-        if (*p || zeros) {
-            if (dna)
-                os << encoder_.decode(kmer) << '\t';
-            os << kmer << '\t' << *p << std::endl;
+    // the vector is cut in blocks of block_kmers, formatted in parallel
+
+    size_t n = pend - pdata;
+    size_t n_blocks = (n + block_kmers - 1) / block_kmers;
+
+    write_blocks(os, n_blocks, kmer_counter::n_threads_, [this, pdata, n, dna, zeros](size_t b, std::string& buf) {
+        size_t lo = b * block_kmers;
+        size_t hi = lo + block_kmers < n ? lo + block_kmers : n;
+        append_vec_range(buf, lo, pdata + lo, hi - lo, dna, zeros);
+    });
+}
+
+template <typename kmer_t, typename count_t>
+void
+kmer_counter_tally<kmer_t, count_t>::write_compact_results(std::ostream &os, bool dna, bool zeros) const
+{
+    // as write_vec_results, but each block first has its counts read from
+    // the cells (and the overflow), into a buffer per thread
+
+    size_t n = static_cast<size_t>(tallyman_->max_value()) + 1;
+    size_t n_blocks = (n + block_kmers - 1) / block_kmers;
+
+    write_blocks(os, n_blocks, kmer_counter::n_threads_, [this, n, dna, zeros](size_t b, std::string& buf) {
+        thread_local std::vector<count_t> counts;
+        size_t lo = b * block_kmers;
+        size_t hi = lo + block_kmers < n ? lo + block_kmers : n;
+        counts.resize(hi - lo);
+        tallyman_->get_results_range(lo, hi - lo, counts.data());
+        append_vec_range(buf, lo, counts.data(), hi - lo, dna, zeros);
+    });
+}
+
+template <typename kmer_t, typename count_t>
+void
+kmer_counter_tally<kmer_t, count_t>::append_vec_range(std::string& buf, size_t lo, const count_t *counts, size_t n, bool dna, bool zeros) const
+{
+    for (size_t i = 0; i != n; ++i) {
+        if (counts[i] || zeros) {
+            kmer_t kmer = static_cast<kmer_t>(lo + i);
+            if (dna) {
+                encoder_.append_decoded(buf, kmer);
+                buf.push_back('\t');
+            }
+            append_number(buf, kmer);
+            buf.push_back('\t');
+            append_number(buf, counts[i]);
+            buf.push_back('\n');
         }
-        ++kmer;
     }
 }
 
@@ -253,51 +426,120 @@ template <typename kmer_t, typename count_t>
 void
 kmer_counter_tally<kmer_t, count_t>::write_map_results(std::ostream &os, bool dna, bool zeros) const
 {
-    const std::map<kmer_t,count_t>& map = tallyman_->get_results_map();
+    // the map may be split in shards that hold consecutive ranges of
+    // k-mers, so we can just output them one after the other
+
+    kmer_t kmer = 0;
+    kmer_t done_kmer = tallyman_->max_value() + 1;
+    char bases[kmer_encoder<kmer_t>::max_ksize];
+
+    for (unsigned n = 0; n != tallyman_->map_shards(); ++n) {
+
+        const std::map<kmer_t,count_t>& map = tallyman_->get_results_shard(n);
 
-    typename std::map<kmer_t,count_t>::const_iterator p = map.begin();
-    typename std::map<kmer_t,count_t>::const_iterator pend = map.end();
+        typename std::map<kmer_t,count_t>::const_iterator p = map.begin();
+        typename std::map<kmer_t,count_t>::const_iterator pend = map.end();
 
-    if (!zeros) {
         while (p != pend) {
+
+            if (zeros)
+                while (kmer != p->first) {
+                    if (dna)
+                        os.write(bases, encoder_.decode(kmer, bases) - bases) << '\t';
+                    os << kmer << "\t0" << std::endl;
+                    ++kmer;
+                }
+
             if (dna)
-                os << encoder_.decode(p->first) << '\t';
+                os.write(bases, encoder_.decode(p->first, bases) - bases) << '\t';
             os << p->first << '\t' << p->second << std::endl;
+
+            kmer = p->first + 1;
             ++p;
         }
     }
-    else {
-        kmer_t kmer = 0;
-        kmer_t done_kmer = tallyman_->max_value() + 1;
-        kmer_t next_kmer = p == pend ? done_kmer : p->first;
 
+    if (zeros)
         while (kmer != done_kmer) {
+            if (dna)
+                os.write(bases, encoder_.decode(kmer, bases) - bases) << '\t';
+            os << kmer << "\t0" << std::endl;
+            ++kmer;
+        }
+}
 
-            while (kmer != next_kmer) {
-                if (dna)
-                    os << encoder_.decode(kmer) << '\t';
-                os << kmer << "\t0" << std::endl;
-                ++kmer;
-            }
 
-            if (kmer != done_kmer) { // so it is next_kmer and p->first
-                if (dna)
-                    os << encoder_.decode(kmer) << '\t';
-                os << kmer << '\t' << p->second << std::endl;
-                next_kmer = ++p == pend ? done_kmer : p->first;
-                ++kmer;
+template <typename kmer_t, typename count_t>
+void
+kmer_counter_tally<kmer_t, count_t>::write_hash_results(std::ostream &os, bool dna, bool zeros) const
+{
+    typedef typename tallyman<kmer_t,count_t>::entry entry;
+
+    size_t n = 0;
+    const entry *pbeg = tallyman_->get_results_hash(n);
+    const entry *pend = pbeg + n;
+    const std::uint64_t done_kmer = static_cast<std::uint64_t>(tallyman_->max_value()) + 1;
+
+    // as in kmer_counter_list, cut the k-mer range in blocks of at most
+    // block_kmers lines, each starting at a k-mer value; the entries are
+    // distinct and sorted, so the block bounds ascend
+
+    std::vector<std::uint64_t> bounds(1, 0);
+
+    if (zeros)
+        for (std::uint64_t v = block_kmers; v < done_kmer; v += block_kmers)
+            bounds.push_back(v);
+    else
+        for (size_t i = block_kmers; i < n; i += block_kmers)
+            bounds.push_back(pbeg[i].value);
+
+    bounds.push_back(done_kmer);
+
+    write_blocks(os, bounds.size() - 1, kmer_counter::n_threads_,
+            [this, &bounds, pbeg, pend, dna, zeros](size_t b, std::string& buf) {
+        const entry *p = std::lower_bound(pbeg, pend, bounds[b],
+                [](const entry& e, std::uint64_t v) { return e.value < v; });
+        std::uint64_t next = bounds[b];
+
+        for (; p != pend && p->value < bounds[b+1]; ++p) {
+            if (zeros)
+                for (; next < p->value; ++next) {
+                    if (dna) {
+                        encoder_.append_decoded(buf, static_cast<kmer_t>(next));
+                        buf.push_back('\t');
+                    }
+                    append_number(buf, next);
+                    buf.append("\t0\n");
+                }
+            if (dna) {
+                encoder_.append_decoded(buf, p->value);
+                buf.push_back('\t');
             }
+            append_number(buf, p->value);
+            buf.push_back('\t');
+            append_number(buf, p->count);
+            buf.push_back('\n');
+            next = static_cast<std::uint64_t>(p->value) + 1;
         }
-    }
-}
 
+        if (zeros)
+            for (; next < bounds[b+1]; ++next) {
+                if (dna) {
+                    encoder_.append_decoded(buf, static_cast<kmer_t>(next));
+                    buf.push_back('\t');
+                }
+                append_number(buf, next);
+                buf.append("\t0\n");
+            }
+    });
+}
 
 // kmer_counter_list methods --------------------------------------------------
 
 template <typename kmer_t>
-kmer_counter_list<kmer_t>::kmer_counter_list(int ksize, bool s_strand, size_t max_count)
-    : kmer_counter(ksize, s_strand),
-      kmers_(0), pkmers_cur_(0), pkmers_end_(0),
+kmer_counter_list<kmer_t>::kmer_counter_list(int ksize, bool s_strand, size_t max_count, unsigned n_threads)
+    : kmer_counter(ksize, s_strand, n_threads),
+      kmers_(0), pkmers_end_(0), pkmers_cur_(0), n_invalid_(0),
       encoder_(ksize, s_strand)
 {
     if (ksize > max_ksize)
@@ -327,30 +569,53 @@ template <typename kmer_t>
 void
 kmer_counter_list<kmer_t>::process(const std::string& data)
 {
-    size_t len = data.size() + 1;
-    if (static_cast<size_t>(ksize_) < len)
-        len -= ksize_;
-    else
-        return;
-
-    kmer_t *new_pcur = pkmers_cur_ + len;
+    thread_local packed_dna packed;
 
-    if (new_pcur <= pkmers_end_) {
-        // first bump the pcur, so later next thread can enter before encode
-        kmer_t *encode_ptr = pkmers_cur_;
-        pkmers_cur_ = new_pcur;
-        encoder_.encode(data, encode_ptr);
-    }
-    else
-        raise_error("k-mer list capacity (%uM k-mers) exhausted",
-                static_cast<unsigned>((pkmers_end_ - kmers_) >> 20));
+    packed.assign(data.data(), data.size());
+    process(packed);
 }
 
 template <typename kmer_t>
 void
 kmer_counter_list<kmer_t>::process(std::string &&data)
 {
-    process(data);
+    process(static_cast<const std::string&>(data));
+}
+
+template <typename kmer_t>
+void
+kmer_counter_list<kmer_t>::process(const packed_dna& data)
+{
+    const size_t n = data.size;
+    const size_t k = ksize_;
+
+    if (n < k)
+        return;
+
+    // only the valid k-mers go in the list; first count them, and add the
+    // others to the invalid count
+
+    size_t n_valid = data.for_each_valid(0, n, k, [](size_t, size_t) { });
+
+    if (n_valid != n - k + 1)
+        n_invalid_.fetch_add(n - k + 1 - n_valid, std::memory_order_relaxed);
+
+    if (!n_valid)
+        return;
+
+    // then bump the pcur, so next thread can enter before we encode;
+    // the atomic add hands each thread its own slice of the list
+
+    kmer_t *encode_ptr = pkmers_cur_.fetch_add(n_valid, std::memory_order_relaxed);
+
+    if (encode_ptr > pkmers_end_ || n_valid > static_cast<size_t>(pkmers_end_ - encode_ptr))
+        raise_error("k-mer list capacity (%uM k-mers) exhausted",
+                static_cast<unsigned>((pkmers_end_ - kmers_) >> 20));
+
+    data.for_each_valid(0, n, k, [this, &data, &encode_ptr, k](size_t lo, size_t hi) {
+        encoder_.encode(data, lo, hi - lo, encode_ptr);
+        encode_ptr += hi - lo - k + 1;
+    });
 }
 
 template <typename kmer_t>
@@ -389,74 +654,41 @@ kmer_counter_list<kmer_t>::write_results(std::ostream &os, unsigned opts) const
         os << (s ? "s-code" : "c-code") << '\t' << "count" << std::endl;
     }
 
-    std::uint64_t n_invalid = 0;
-    kmer_t *p = kmers_;
+    kmer_t *pcur = pkmers_cur_.load();
 
-    if (p && p != pkmers_cur_) {
+    radix_sort(kmers_, pcur, 2*k-(s?0:1), kmer_counter::n_threads_);
 
-        std::sort(kmers_, pkmers_cur_);
+    // the list holds no invalid k-mers, but if it did they would have their
+    // high bit set, so be sorted to the end
 
-        if (encoder_.is_invalid(*p)) {
-            // we hit invalid right away, but since we're sorted
-            // this means we are done (invalid is beyond max)
-            n_invalid = pkmers_cur_ - p;
-            if (do_zeros)
-                for (kmer_t i = 0; i <= encoder_.max_kmer(); ++i) {
-                    if (do_dna) os << encoder_.decode(i) << '\t';
-                    os << i << '\t' << 0 << std::endl;
-                }
-        }
-        else {
+    const std::uint64_t done_kmer = static_cast<std::uint64_t>(encoder_.max_kmer()) + 1;
+    const kmer_t *pvalid = std::lower_bound(static_cast<const kmer_t*>(kmers_),
+            static_cast<const kmer_t*>(pcur), static_cast<kmer_t>(done_kmer));
+    std::uint64_t n_invalid = n_invalid_.load() + (pcur - pvalid);
 
-            kmer_t last = *p;
-            std::uint64_t count = 1;
+    // cut the k-mer range in blocks of at most block_kmers lines, each
+    // starting at a k-mer value; without zeros a block spans block_kmers
+    // list entries, with zeros it spans block_kmers k-mer values
 
-            // optionally generate zeros for kmers 0..last-1
-            if (do_zeros)
-                for (kmer_t i = 0; i < last; ++i) {
-                    if (do_dna) os << encoder_.decode(i) << '\t';
-                    os << i << '\t' << 0 << std::endl;
-                }
+    std::vector<std::uint64_t> bounds(1, 0);
 
-            while (++p != pkmers_cur_) {
-                if (*p == last) {   // continue run of last value
-                    ++count;
-                }
-                else if (encoder_.is_invalid(*p)) {
-                    n_invalid += pkmers_cur_ - p;
-                    break;
-                }
-                else {
-                    if (do_dna) os << encoder_.decode(last) << '\t';
-                    os << last << '\t' << count << std::endl;
-
-                    if (do_zeros)
-                        while (++last != *p) {
-                            if (do_dna) os << encoder_.decode(last) << '\t';
-                            os << last << '\t' << 0 << std::endl;
-                        }
-
-                    last = *p;
-                    count = 1;
-                }
-            }
+    if (do_zeros)
+        for (std::uint64_t v = block_kmers; v < done_kmer; v += block_kmers)
+            bounds.push_back(v);
+    else
+        for (const kmer_t *q = kmers_ + block_kmers; q < pvalid; q += block_kmers)
+            if (*q > bounds.back())
+                bounds.push_back(*q);
 
-            if (do_dna) os << encoder_.decode(last) << '\t';
-            os << last << '\t' << count << std::endl;
+    bounds.push_back(done_kmer);
 
-            if (do_zeros)
-                while (++last <= encoder_.max_kmer()) {
-                    if (do_dna) os << encoder_.decode(last) << '\t';
-                    os << last << '\t' << 0 << std::endl;
-                }
-        }
-    }
-    else if (do_zeros) {
-        for (kmer_t i = 0; i <= encoder_.max_kmer(); ++i) {
-            if (do_dna) os << encoder_.decode(i) << '\t';
-            os << i << '\t' << 0 << std::endl;
-        }
-    }
+    write_blocks(os, bounds.size() - 1, kmer_counter::n_threads_,
+            [this, &bounds, pvalid, do_dna, do_zeros](size_t b, std::string& buf) {
+        const kmer_t *p = std::lower_bound(static_cast<const kmer_t*>(kmers_), pvalid, static_cast<kmer_t>(bounds[b]));
+        const kmer_t *pend = b + 2 == bounds.size() ? pvalid
+            : std::lower_bound(p, pvalid, static_cast<kmer_t>(bounds[b+1]));
+        write_range(buf, p, pend, bounds[b], bounds[b+1], do_dna, do_zeros);
+    });
 
     if (do_invalid && (n_invalid || do_zeros)) {
         if (do_dna) os << "invalid\t";
@@ -465,12 +697,62 @@ kmer_counter_list<kmer_t>::write_results(std::ostream &os, unsigned opts) const
 
     if (n_invalid) {
         verbose_emit("counted %lu k-mers, %lu invalid", 
-                static_cast<unsigned long>(pkmers_cur_ - kmers_), static_cast<unsigned long>(n_invalid));
+                static_cast<unsigned long>((pvalid - kmers_) + n_invalid), static_cast<unsigned long>(n_invalid));
     }
 
     return os;
 }
 
+// write_range - append to buf the count lines for the k-mer values [lo,hi),
+//               given [p,pend) the sorted list entries in that range
+//
+template <typename kmer_t>
+void
+kmer_counter_list<kmer_t>::write_range(std::string& buf, const kmer_t *p, const kmer_t *pend,
+        std::uint64_t lo, std::uint64_t hi, bool dna, bool zeros) const
+{
+    std::uint64_t next = lo;
+
+    while (p != pend) {
+
+        kmer_t kmer = *p;
+        const kmer_t *prun = p;
+        while (++p != pend && *p == kmer)
+            ;
+
+        if (zeros)
+            for (; next < kmer; ++next) {
+                if (dna) {
+                    encoder_.append_decoded(buf, static_cast<kmer_t>(next));
+                    buf.push_back('\t');
+                }
+                append_number(buf, next);
+                buf.append("\t0\n");
+            }
+
+        if (dna) {
+            encoder_.append_decoded(buf, kmer);
+            buf.push_back('\t');
+        }
+        append_number(buf, kmer);
+        buf.push_back('\t');
+        append_number(buf, static_cast<std::uint64_t>(p - prun));
+        buf.push_back('\n');
+
+        next = static_cast<std::uint64_t>(kmer) + 1;
+    }
+
+    if (zeros)
+        for (; next < hi; ++next) {
+            if (dna) {
+                encoder_.append_decoded(buf, static_cast<kmer_t>(next));
+                buf.push_back('\t');
+            }
+            append_number(buf, next);
+            buf.append("\t0\n");
+        }
+}
+
 
 } // namespace kfc
 
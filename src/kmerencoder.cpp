@@ -18,196 +18,376 @@
 
 #include <cstdlib>
 #include <string>
+#include <vector>
 #include "kmerencoder.h"
 #include "kmercodec.h"
+#include "basepack.h"
 
 namespace kfc {
 
-typedef void (*encode_fn32)(const char*, const char*, std::uint32_t*);
-typedef void (*encode_fn64)(const char*, const char*, std::uint64_t*);
+typedef void (*encode_fn32)(const char*, const char*, std::uint32_t*, pack_fn);
+typedef void (*encode_fn64)(const char*, const char*, std::uint64_t*, pack_fn);
 
-typedef std::string (*decode_fn32)(std::uint32_t, bool);
-typedef std::string (*decode_fn64)(std::uint64_t, bool);
+typedef void (*word_encode_fn32)(const packed_dna&, size_t, size_t, std::uint32_t*);
+typedef void (*word_encode_fn64)(const packed_dna&, size_t, size_t, std::uint64_t*);
+
+typedef void (*canon_fn32)(std::uint32_t*, std::uint32_t*);
+typedef void (*canon_fn64)(std::uint64_t*, std::uint64_t*);
+
+typedef char* (*decode_fn32)(std::uint32_t, char*, bool);
+typedef char* (*decode_fn64)(std::uint64_t, char*, bool);
+
+// packed encode wrappers ----------------------------------------------
+//
+// These convert the input to base codes and invalid mask with the encoder's
+// pack kernel, into buffers that each thread keeps, then run the packed
+// rolling encoders.
+
+struct pack_buffer {
+    std::vector<std::uint8_t> codes;
+    std::vector<std::uint64_t> mask;
+};
+
+static const pack_buffer&
+pack_input(const char *p0, const char *p1, pack_fn pack)
+{
+    thread_local pack_buffer buf;
+
+    size_t n = p1 - p0;
+
+    if (buf.codes.size() < n) {
+        buf.codes.resize(n);
+        buf.mask.resize((n + 63) / 64);
+    }
+
+    pack(p0, n, buf.codes.data(), buf.mask.data());
+    return buf;
+}
+
+template <typename kmer_t, unsigned ksize>
+static void
+ss_encode_pk(const char *p0, const char *p1, kmer_t *t, pack_fn pack)
+{
+    const pack_buffer& buf = pack_input(p0, p1, pack);
+    ss_encode_packed<kmer_t,ksize>(buf.codes.data(), buf.mask.data(), p1 - p0, t);
+}
+
+// packed_dna encode wrappers ------------------------------------------
+//
+// These roll the kmers out of the n bases from pos in the 2-bit words, then
+// flag the ones that overlap the invalid runs.
+
+template <typename kmer_t, unsigned ksize>
+static void
+ss_encode_pd(const packed_dna& d, size_t pos, size_t n, kmer_t *t)
+{
+    ss_encode_words<kmer_t,ksize>(d.words.data(), pos, n, t);
+    mark_invalid_runs(d.invalid.begin(), d.invalid.end(), pos, n, ksize, t);
+}
 
 // encode functions ----------------------------------------------------
+//
+// There are single strand encoders only: a double strand kmer_encoder
+// encodes single stranded, then converts the block with its canon function.
 
 static encode_fn32 ss_enc32[16] = {
     0,
-    ss_encode<std::uint32_t,1>,
-    ss_encode<std::uint32_t,2>,
-    ss_encode<std::uint32_t,3>,
-    ss_encode<std::uint32_t,4>,
-    ss_encode<std::uint32_t,5>,
-    ss_encode<std::uint32_t,6>,
-    ss_encode<std::uint32_t,7>,
-    ss_encode<std::uint32_t,8>,
-    ss_encode<std::uint32_t,9>,
-    ss_encode<std::uint32_t,10>,
-    ss_encode<std::uint32_t,11>,
-    ss_encode<std::uint32_t,12>,
-    ss_encode<std::uint32_t,13>,
-    ss_encode<std::uint32_t,14>,
-    ss_encode<std::uint32_t,15>
+    ss_encode_pk<std::uint32_t,1>,
+    ss_encode_pk<std::uint32_t,2>,
+    ss_encode_pk<std::uint32_t,3>,
+    ss_encode_pk<std::uint32_t,4>,
+    ss_encode_pk<std::uint32_t,5>,
+    ss_encode_pk<std::uint32_t,6>,
+    ss_encode_pk<std::uint32_t,7>,
+    ss_encode_pk<std::uint32_t,8>,
+    ss_encode_pk<std::uint32_t,9>,
+    ss_encode_pk<std::uint32_t,10>,
+    ss_encode_pk<std::uint32_t,11>,
+    ss_encode_pk<std::uint32_t,12>,
+    ss_encode_pk<std::uint32_t,13>,
+    ss_encode_pk<std::uint32_t,14>,
+    ss_encode_pk<std::uint32_t,15>
 };
 
-static encode_fn32 ds_enc32[16] = {
-    0, ds_encode<std::uint32_t,1>,
-    0, ds_encode<std::uint32_t,3>,
-    0, ds_encode<std::uint32_t,5>,
-    0, ds_encode<std::uint32_t,7>,
-    0, ds_encode<std::uint32_t,9>,
-    0, ds_encode<std::uint32_t,11>,
-    0, ds_encode<std::uint32_t,13>,
-    0, ds_encode<std::uint32_t,15>
+static encode_fn64 ss_enc64[32] = {
+    0,
+    ss_encode_pk<std::uint64_t,1>,
+    ss_encode_pk<std::uint64_t,2>,
+    ss_encode_pk<std::uint64_t,3>,
+    ss_encode_pk<std::uint64_t,4>,
+    ss_encode_pk<std::uint64_t,5>,
+    ss_encode_pk<std::uint64_t,6>,
+    ss_encode_pk<std::uint64_t,7>,
+    ss_encode_pk<std::uint64_t,8>,
+    ss_encode_pk<std::uint64_t,9>,
+    ss_encode_pk<std::uint64_t,10>,
+    ss_encode_pk<std::uint64_t,11>,
+    ss_encode_pk<std::uint64_t,12>,
+    ss_encode_pk<std::uint64_t,13>,
+    ss_encode_pk<std::uint64_t,14>,
+    ss_encode_pk<std::uint64_t,15>,
+    ss_encode_pk<std::uint64_t,16>,
+    ss_encode_pk<std::uint64_t,17>,
+    ss_encode_pk<std::uint64_t,18>,
+    ss_encode_pk<std::uint64_t,19>,
+    ss_encode_pk<std::uint64_t,20>,
+    ss_encode_pk<std::uint64_t,21>,
+    ss_encode_pk<std::uint64_t,22>,
+    ss_encode_pk<std::uint64_t,23>,
+    ss_encode_pk<std::uint64_t,24>,
+    ss_encode_pk<std::uint64_t,25>,
+    ss_encode_pk<std::uint64_t,26>,
+    ss_encode_pk<std::uint64_t,27>,
+    ss_encode_pk<std::uint64_t,28>,
+    ss_encode_pk<std::uint64_t,29>,
+    ss_encode_pk<std::uint64_t,30>,
+    ss_encode_pk<std::uint64_t,31>
 };
 
-static encode_fn64 ss_enc64[32] = {
+// word encode functions -----------------------------------------------
+
+static word_encode_fn32 ss_wenc32[16] = {
     0,
-    ss_encode<std::uint64_t,1>,
-    ss_encode<std::uint64_t,2>,
-    ss_encode<std::uint64_t,3>,
-    ss_encode<std::uint64_t,4>,
-    ss_encode<std::uint64_t,5>,
-    ss_encode<std::uint64_t,6>,
-    ss_encode<std::uint64_t,7>,
-    ss_encode<std::uint64_t,8>,
-    ss_encode<std::uint64_t,9>,
-    ss_encode<std::uint64_t,10>,
-    ss_encode<std::uint64_t,11>,
-    ss_encode<std::uint64_t,12>,
-    ss_encode<std::uint64_t,13>,
-    ss_encode<std::uint64_t,14>,
-    ss_encode<std::uint64_t,15>,
-    ss_encode<std::uint64_t,16>,
-    ss_encode<std::uint64_t,17>,
-    ss_encode<std::uint64_t,18>,
-    ss_encode<std::uint64_t,19>,
-    ss_encode<std::uint64_t,20>,
-    ss_encode<std::uint64_t,21>,
-    ss_encode<std::uint64_t,22>,
-    ss_encode<std::uint64_t,23>,
-    ss_encode<std::uint64_t,24>,
-    ss_encode<std::uint64_t,25>,
-    ss_encode<std::uint64_t,26>,
-    ss_encode<std::uint64_t,27>,
-    ss_encode<std::uint64_t,28>,
-    ss_encode<std::uint64_t,29>,
-    ss_encode<std::uint64_t,30>,
-    ss_encode<std::uint64_t,31>
+    ss_encode_pd<std::uint32_t,1>,
+    ss_encode_pd<std::uint32_t,2>,
+    ss_encode_pd<std::uint32_t,3>,
+    ss_encode_pd<std::uint32_t,4>,
+    ss_encode_pd<std::uint32_t,5>,
+    ss_encode_pd<std::uint32_t,6>,
+    ss_encode_pd<std::uint32_t,7>,
+    ss_encode_pd<std::uint32_t,8>,
+    ss_encode_pd<std::uint32_t,9>,
+    ss_encode_pd<std::uint32_t,10>,
+    ss_encode_pd<std::uint32_t,11>,
+    ss_encode_pd<std::uint32_t,12>,
+    ss_encode_pd<std::uint32_t,13>,
+    ss_encode_pd<std::uint32_t,14>,
+    ss_encode_pd<std::uint32_t,15>
 };
 
-static encode_fn64 ds_enc64[32] = {
-    0, ds_encode<std::uint64_t,1>,
-    0, ds_encode<std::uint64_t,3>,
-    0, ds_encode<std::uint64_t,5>,
-    0, ds_encode<std::uint64_t,7>,
-    0, ds_encode<std::uint64_t,9>,
-    0, ds_encode<std::uint64_t,11>,
-    0, ds_encode<std::uint64_t,13>,
-    0, ds_encode<std::uint64_t,15>,
-    0, ds_encode<std::uint64_t,17>,
-    0, ds_encode<std::uint64_t,19>,
-    0, ds_encode<std::uint64_t,21>,
-    0, ds_encode<std::uint64_t,23>,
-    0, ds_encode<std::uint64_t,25>,
-    0, ds_encode<std::uint64_t,27>,
-    0, ds_encode<std::uint64_t,29>,
-    0, ds_encode<std::uint64_t,31>
+static word_encode_fn64 ss_wenc64[32] = {
+    0,
+    ss_encode_pd<std::uint64_t,1>,
+    ss_encode_pd<std::uint64_t,2>,
+    ss_encode_pd<std::uint64_t,3>,
+    ss_encode_pd<std::uint64_t,4>,
+    ss_encode_pd<std::uint64_t,5>,
+    ss_encode_pd<std::uint64_t,6>,
+    ss_encode_pd<std::uint64_t,7>,
+    ss_encode_pd<std::uint64_t,8>,
+    ss_encode_pd<std::uint64_t,9>,
+    ss_encode_pd<std::uint64_t,10>,
+    ss_encode_pd<std::uint64_t,11>,
+    ss_encode_pd<std::uint64_t,12>,
+    ss_encode_pd<std::uint64_t,13>,
+    ss_encode_pd<std::uint64_t,14>,
+    ss_encode_pd<std::uint64_t,15>,
+    ss_encode_pd<std::uint64_t,16>,
+    ss_encode_pd<std::uint64_t,17>,
+    ss_encode_pd<std::uint64_t,18>,
+    ss_encode_pd<std::uint64_t,19>,
+    ss_encode_pd<std::uint64_t,20>,
+    ss_encode_pd<std::uint64_t,21>,
+    ss_encode_pd<std::uint64_t,22>,
+    ss_encode_pd<std::uint64_t,23>,
+    ss_encode_pd<std::uint64_t,24>,
+    ss_encode_pd<std::uint64_t,25>,
+    ss_encode_pd<std::uint64_t,26>,
+    ss_encode_pd<std::uint64_t,27>,
+    ss_encode_pd<std::uint64_t,28>,
+    ss_encode_pd<std::uint64_t,29>,
+    ss_encode_pd<std::uint64_t,30>,
+    ss_encode_pd<std::uint64_t,31>
+};
+
+// canonicalise functions ----------------------------------------------
+//
+// The batch ss to ds conversion, built for the default target and for AVX2.
+// The AVX2 build vectorises the byte swaps in ss_revcomp with vpshufb, and
+// is picked when the pack kernel says the CPU has AVX2.
+
+template <typename kmer_t, unsigned ksize>
+__attribute__((target("avx2")))
+static void
+ss_to_ds_avx2(kmer_t *p, kmer_t *e)
+{
+    ss_to_ds_range<kmer_t,ksize>(p, e);
+}
+
+static canon_fn32 ds_canon32[16] = {
+    0, ss_to_ds_range<std::uint32_t,1>,
+    0, ss_to_ds_range<std::uint32_t,3>,
+    0, ss_to_ds_range<std::uint32_t,5>,
+    0, ss_to_ds_range<std::uint32_t,7>,
+    0, ss_to_ds_range<std::uint32_t,9>,
+    0, ss_to_ds_range<std::uint32_t,11>,
+    0, ss_to_ds_range<std::uint32_t,13>,
+    0, ss_to_ds_range<std::uint32_t,15>
+};
+
+static canon_fn32 ds_canon32_avx2[16] = {
+    0, ss_to_ds_avx2<std::uint32_t,1>,
+    0, ss_to_ds_avx2<std::uint32_t,3>,
+    0, ss_to_ds_avx2<std::uint32_t,5>,
+    0, ss_to_ds_avx2<std::uint32_t,7>,
+    0, ss_to_ds_avx2<std::uint32_t,9>,
+    0, ss_to_ds_avx2<std::uint32_t,11>,
+    0, ss_to_ds_avx2<std::uint32_t,13>,
+    0, ss_to_ds_avx2<std::uint32_t,15>
+};
+
+static canon_fn64 ds_canon64[32] = {
+    0, ss_to_ds_range<std::uint64_t,1>,
+    0, ss_to_ds_range<std::uint64_t,3>,
+    0, ss_to_ds_range<std::uint64_t,5>,
+    0, ss_to_ds_range<std::uint64_t,7>,
+    0, ss_to_ds_range<std::uint64_t,9>,
+    0, ss_to_ds_range<std::uint64_t,11>,
+    0, ss_to_ds_range<std::uint64_t,13>,
+    0, ss_to_ds_range<std::uint64_t,15>,
+    0, ss_to_ds_range<std::uint64_t,17>,
+    0, ss_to_ds_range<std::uint64_t,19>,
+    0, ss_to_ds_range<std::uint64_t,21>,
+    0, ss_to_ds_range<std::uint64_t,23>,
+    0, ss_to_ds_range<std::uint64_t,25>,
+    0, ss_to_ds_range<std::uint64_t,27>,
+    0, ss_to_ds_range<std::uint64_t,29>,
+    0, ss_to_ds_range<std::uint64_t,31>
+};
+
+static canon_fn64 ds_canon64_avx2[32] = {
+    0, ss_to_ds_avx2<std::uint64_t,1>,
+    0, ss_to_ds_avx2<std::uint64_t,3>,
+    0, ss_to_ds_avx2<std::uint64_t,5>,
+    0, ss_to_ds_avx2<std::uint64_t,7>,
+    0, ss_to_ds_avx2<std::uint64_t,9>,
+    0, ss_to_ds_avx2<std::uint64_t,11>,
+    0, ss_to_ds_avx2<std::uint64_t,13>,
+    0, ss_to_ds_avx2<std::uint64_t,15>,
+    0, ss_to_ds_avx2<std::uint64_t,17>,
+    0, ss_to_ds_avx2<std::uint64_t,19>,
+    0, ss_to_ds_avx2<std::uint64_t,21>,
+    0, ss_to_ds_avx2<std::uint64_t,23>,
+    0, ss_to_ds_avx2<std::uint64_t,25>,
+    0, ss_to_ds_avx2<std::uint64_t,27>,
+    0, ss_to_ds_avx2<std::uint64_t,29>,
+    0, ss_to_ds_avx2<std::uint64_t,31>
 };
 
 // decode functions ---------------------------------------------------
 
 static decode_fn32 ss_dec32[16] = {
     0,
-    ss_decode<std::uint32_t,1>,
-    ss_decode<std::uint32_t,2>,
-    ss_decode<std::uint32_t,3>,
-    ss_decode<std::uint32_t,4>,
-    ss_decode<std::uint32_t,5>,
-    ss_decode<std::uint32_t,6>,
-    ss_decode<std::uint32_t,7>,
-    ss_decode<std::uint32_t,8>,
-    ss_decode<std::uint32_t,9>,
-    ss_decode<std::uint32_t,10>,
-    ss_decode<std::uint32_t,11>,
-    ss_decode<std::uint32_t,12>,
-    ss_decode<std::uint32_t,13>,
-    ss_decode<std::uint32_t,14>,
-    ss_decode<std::uint32_t,15>
+    ss_decode_to<std::uint32_t,1>,
+    ss_decode_to<std::uint32_t,2>,
+    ss_decode_to<std::uint32_t,3>,
+    ss_decode_to<std::uint32_t,4>,
+    ss_decode_to<std::uint32_t,5>,
+    ss_decode_to<std::uint32_t,6>,
+    ss_decode_to<std::uint32_t,7>,
+    ss_decode_to<std::uint32_t,8>,
+    ss_decode_to<std::uint32_t,9>,
+    ss_decode_to<std::uint32_t,10>,
+    ss_decode_to<std::uint32_t,11>,
+    ss_decode_to<std::uint32_t,12>,
+    ss_decode_to<std::uint32_t,13>,
+    ss_decode_to<std::uint32_t,14>,
+    ss_decode_to<std::uint32_t,15>
 };
 
 static decode_fn32 ds_dec32[16] = {
-    0, ds_decode<std::uint32_t,1>,
-    0, ds_decode<std::uint32_t,3>,
-    0, ds_decode<std::uint32_t,5>,
-    0, ds_decode<std::uint32_t,7>,
-    0, ds_decode<std::uint32_t,9>,
-    0, ds_decode<std::uint32_t,11>,
-    0, ds_decode<std::uint32_t,13>,
-    0, ds_decode<std::uint32_t,15>
+    0, ds_decode_to<std::uint32_t,1>,
+    0, ds_decode_to<std::uint32_t,3>,
+    0, ds_decode_to<std::uint32_t,5>,
+    0, ds_decode_to<std::uint32_t,7>,
+    0, ds_decode_to<std::uint32_t,9>,
+    0, ds_decode_to<std::uint32_t,11>,
+    0, ds_decode_to<std::uint32_t,13>,
+    0, ds_decode_to<std::uint32_t,15>
 };
 
 static decode_fn64 ss_dec64[32] = {
     0,
-    ss_decode<std::uint64_t,1>,
-    ss_decode<std::uint64_t,2>,
-    ss_decode<std::uint64_t,3>,
-    ss_decode<std::uint64_t,4>,
-    ss_decode<std::uint64_t,5>,
-    ss_decode<std::uint64_t,6>,
-    ss_decode<std::uint64_t,7>,
-    ss_decode<std::uint64_t,8>,
-    ss_decode<std::uint64_t,9>,
-    ss_decode<std::uint64_t,10>,
-    ss_decode<std::uint64_t,11>,
-    ss_decode<std::uint64_t,12>,
-    ss_decode<std::uint64_t,13>,
-    ss_decode<std::uint64_t,14>,
-    ss_decode<std::uint64_t,15>,
-    ss_decode<std::uint64_t,16>,
-    ss_decode<std::uint64_t,17>,
-    ss_decode<std::uint64_t,18>,
-    ss_decode<std::uint64_t,19>,
-    ss_decode<std::uint64_t,20>,
-    ss_decode<std::uint64_t,21>,
-    ss_decode<std::uint64_t,22>,
-    ss_decode<std::uint64_t,23>,
-    ss_decode<std::uint64_t,24>,
-    ss_decode<std::uint64_t,25>,
-    ss_decode<std::uint64_t,26>,
-    ss_decode<std::uint64_t,27>,
-    ss_decode<std::uint64_t,28>,
-    ss_decode<std::uint64_t,29>,
-    ss_decode<std::uint64_t,30>,
-    ss_decode<std::uint64_t,31>
+    ss_decode_to<std::uint64_t,1>,
+    ss_decode_to<std::uint64_t,2>,
+    ss_decode_to<std::uint64_t,3>,
+    ss_decode_to<std::uint64_t,4>,
+    ss_decode_to<std::uint64_t,5>,
+    ss_decode_to<std::uint64_t,6>,
+    ss_decode_to<std::uint64_t,7>,
+    ss_decode_to<std::uint64_t,8>,
+    ss_decode_to<std::uint64_t,9>,
+    ss_decode_to<std::uint64_t,10>,
+    ss_decode_to<std::uint64_t,11>,
+    ss_decode_to<std::uint64_t,12>,
+    ss_decode_to<std::uint64_t,13>,
+    ss_decode_to<std::uint64_t,14>,
+    ss_decode_to<std::uint64_t,15>,
+    ss_decode_to<std::uint64_t,16>,
+    ss_decode_to<std::uint64_t,17>,
+    ss_decode_to<std::uint64_t,18>,
+    ss_decode_to<std::uint64_t,19>,
+    ss_decode_to<std::uint64_t,20>,
+    ss_decode_to<std::uint64_t,21>,
+    ss_decode_to<std::uint64_t,22>,
+    ss_decode_to<std::uint64_t,23>,
+    ss_decode_to<std::uint64_t,24>,
+    ss_decode_to<std::uint64_t,25>,
+    ss_decode_to<std::uint64_t,26>,
+    ss_decode_to<std::uint64_t,27>,
+    ss_decode_to<std::uint64_t,28>,
+    ss_decode_to<std::uint64_t,29>,
+    ss_decode_to<std::uint64_t,30>,
+    ss_decode_to<std::uint64_t,31>
 };
 
 static decode_fn64 ds_dec64[32] = {
-    0, ds_decode<std::uint64_t,1>,
-    0, ds_decode<std::uint64_t,3>,
-    0, ds_decode<std::uint64_t,5>,
-    0, ds_decode<std::uint64_t,7>,
-    0, ds_decode<std::uint64_t,9>,
-    0, ds_decode<std::uint64_t,11>,
-    0, ds_decode<std::uint64_t,13>,
-    0, ds_decode<std::uint64_t,15>,
-    0, ds_decode<std::uint64_t,17>,
-    0, ds_decode<std::uint64_t,19>,
-    0, ds_decode<std::uint64_t,21>,
-    0, ds_decode<std::uint64_t,23>,
-    0, ds_decode<std::uint64_t,25>,
-    0, ds_decode<std::uint64_t,27>,
-    0, ds_decode<std::uint64_t,29>,
-    0, ds_decode<std::uint64_t,31>
+    0, ds_decode_to<std::uint64_t,1>,
+    0, ds_decode_to<std::uint64_t,3>,
+    0, ds_decode_to<std::uint64_t,5>,
+    0, ds_decode_to<std::uint64_t,7>,
+    0, ds_decode_to<std::uint64_t,9>,
+    0, ds_decode_to<std::uint64_t,11>,
+    0, ds_decode_to<std::uint64_t,13>,
+    0, ds_decode_to<std::uint64_t,15>,
+    0, ds_decode_to<std::uint64_t,17>,
+    0, ds_decode_to<std::uint64_t,19>,
+    0, ds_decode_to<std::uint64_t,21>,
+    0, ds_decode_to<std::uint64_t,23>,
+    0, ds_decode_to<std::uint64_t,25>,
+    0, ds_decode_to<std::uint64_t,27>,
+    0, ds_decode_to<std::uint64_t,29>,
+    0, ds_decode_to<std::uint64_t,31>
 };
 
 // define the init_ member ---------------------------------------------
 
+static bool
+has_avx2(pack_kernel k)
+{
+    return k == pack_kernel::avx2 || k == pack_kernel::avx512bw;
+}
+
+// report what kfc uses of the encoder: the counters pack through packed_dna,
+// not through pack_, so only the canonicalise and decode are reported
+
+static void
+report_kernel(unsigned ksize, bool sstrand, unsigned bits, pack_kernel k)
+{
+    verbose_emit("k-mer encoder: ksize %u, %s strand, %u-bit kmer_t: %s canonicalise, table decode",
+            ksize, sstrand ? "single" : "double", bits,
+            sstrand ? "no" : has_avx2(k) ? "avx2" : "scalar");
+}
+
 template<>
 void
 kmer_encoder<std::uint32_t>::init_(unsigned ksize, bool sstrand)
 {
-    encode_ = sstrand ? ss_enc32[ksize] : ds_enc32[ksize];
+    pack_ = pack_function(kernel_);
+    report_kernel(ksize, sstrand, 32, kernel_);
+    encode_ = ss_enc32[ksize];
+    word_encode_ = ss_wenc32[ksize];
+    canon_ = sstrand ? 0 : has_avx2(kernel_) ? ds_canon32_avx2[ksize] : ds_canon32[ksize];
     decode_ = sstrand ? ss_dec32[ksize] : ds_dec32[ksize];
 }
 
@@ -215,7 +395,11 @@ template<>
 void
 kmer_encoder<std::uint64_t>::init_(unsigned ksize, bool sstrand)
 {
-    encode_ = sstrand ? ss_enc64[ksize] : ds_enc64[ksize];
+    pack_ = pack_function(kernel_);
+    report_kernel(ksize, sstrand, 64, kernel_);
+    encode_ = ss_enc64[ksize];
+    word_encode_ = ss_wenc64[ksize];
+    canon_ = sstrand ? 0 : has_avx2(kernel_) ? ds_canon64_avx2[ksize] : ds_canon64[ksize];
     decode_ = sstrand ? ss_dec64[ksize] : ds_dec64[ksize];
 }
 
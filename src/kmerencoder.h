@@ -20,6 +20,7 @@
 
 #include <string>
 #include <vector>
+#include "basepack.h"
 #include "bitfiddle.h"
 #include "utils.h"
 
@@ -41,21 +42,50 @@ namespace kfc {
 // as an arbitrary number with its high bit set.  The is_invalid() method
 // tests for this.
 //
+// The encode(packed_dna) members do the same for DNA that was packed at two
+// bits per base (see basepack.h), rolling the kmers straight out of the
+// packed words.  With pos and n given, they encode only the n bases from pos,
+// which lets callers encode a long sequence in blocks.
+//
+// The canonicalise() member converts single-strand encoded kmers in place
+// to the encoder's encoding.  For a double strand encoder this is the batch
+// ss_to_ds conversion (see kmercodec.h); for a single strand encoder it
+// leaves the kmers as they are.  The double strand encoder itself encodes
+// single stranded and then canonicalises the block: the ss rolling encoders
+// plus the (vectorised) batch conversion are much faster than rolling both
+// strands and picking one per kmer.  The counting engine (see countengine.h)
+// canonicalises its blocks of rolled kmers with this member too.
+//
 // The decode(kmer_t) member decodes a kmer to a string of DNA.  It decodes
-// invalid kmers to strings of "X" bases.
+// invalid kmers to strings of "X" bases.  The decode(kmer_t, char*) members
+// write the ksize bases straight into a caller's buffer instead, for one
+// kmer or back to back for a range of them, and return the end of what they
+// wrote; append_decoded() appends the bases to a string.  These copy four
+// bases per step from a table and do not allocate, so output should use
+// them rather than decode(kmer_t).
 //
 // The encode() and decode() members delegate to private function pointers
 // which are set in the init_() private member function.  This enables
 // swapping out the back-end implementation.  The default implementation
 // is in kmerencoder.cpp.
 //
+// Encoding strings first converts the bases with pack_bases (see basepack.h),
+// using the pack kernel passed to the constructor, by default the best one
+// the CPU supports.  The kernel also picks the canonicalise function: the
+// AVX2 build of ss_to_ds_range where the CPU has AVX2.  The counters do not
+// encode strings but packed_dna, which packs with the best kernel itself, so
+// with verbose output on init_() reports only the canonicalise and decode.
+// There is one decode implementation, the table decode.
+//
 template <typename kmer_t>
 class kmer_encoder {
     static_assert(std::is_unsigned<kmer_t>::value,
             "template argument kmer_t must be unsigned integral");
 
-    typedef void (*encode_fn)(const char*, const char*, kmer_t*);
-    typedef std::string (*decode_fn)(kmer_t, bool);
+    typedef void (*encode_fn)(const char*, const char*, kmer_t*, pack_fn);
+    typedef void (*word_encode_fn)(const packed_dna&, size_t, size_t, kmer_t*);
+    typedef void (*canon_fn)(kmer_t*, kmer_t*);
+    typedef char* (*decode_fn)(kmer_t, char*, bool);
 
     public:
         constexpr static unsigned max_ksize = (bitsize<kmer_t> -1 ) / 2;
@@ -65,23 +95,37 @@ class kmer_encoder {
         const unsigned ksize_;
         const bool sstrand_;
         const kmer_t max_kmer_;
+        const pack_kernel kernel_;
+        pack_fn pack_;
         encode_fn encode_;
+        word_encode_fn word_encode_;
+        canon_fn canon_;
         decode_fn decode_;
 
     public:
         explicit kmer_encoder(unsigned ksize, bool sstrand = false);
+        kmer_encoder(unsigned ksize, bool sstrand, pack_kernel kernel);
 
         kmer_t max_kmer() const { return max_kmer_; }
+        pack_kernel kernel() const { return kernel_; }
 
         void encode(const char*, const char*, kmer_t*) const;
         void encode(const std::string&, kmer_t*) const;
         void encode(std::string&&, kmer_t*) const;
+        void encode(const packed_dna&, kmer_t*) const;
+        void encode(const packed_dna&, size_t pos, size_t n, kmer_t*) const;
 
         kmer_t encode_kmer(const char*) const;
         std::vector<kmer_t> encode(const std::string&) const;
         std::vector<kmer_t> encode(std::string&&) const;
+        std::vector<kmer_t> encode(const packed_dna&) const;
+
+        void canonicalise(kmer_t*, kmer_t*) const;
 
         std::string decode(kmer_t, bool rc = false) const;
+        char* decode(kmer_t, char*, bool rc = false) const;
+        char* decode(const kmer_t*, const kmer_t*, char*, bool rc = false) const;
+        void append_decoded(std::string&, kmer_t) const;
 
     private:
         void init_(unsigned, bool);
@@ -92,9 +136,15 @@ class kmer_encoder {
 
 template <typename kmer_t>
 kmer_encoder<kmer_t>::kmer_encoder(unsigned ksize, bool sstrand)
+    : kmer_encoder(ksize, sstrand, best_pack_kernel())
+{
+}
+
+template <typename kmer_t>
+kmer_encoder<kmer_t>::kmer_encoder(unsigned ksize, bool sstrand, pack_kernel kernel)
     : ksize_(ksize), sstrand_(sstrand), 
       max_kmer_((((kmer_t)1)<<(2*ksize-(sstrand?0:1)))-1),
-      encode_(0), decode_(0)
+      kernel_(kernel), pack_(0), encode_(0), word_encode_(0), canon_(0), decode_(0)
 {
     if (ksize < 1)
         raise_error("invalid k-mer size: %d", ksize);
@@ -112,24 +162,41 @@ template <typename kmer_t>
 void
 kmer_encoder<kmer_t>::encode(const char *pbeg, const char *pend, kmer_t* t) const
 {
-    if (pbeg + ksize_ <= pend)
-        encode_(pbeg, pend, t);
+    if (pbeg + ksize_ <= pend) {
+        encode_(pbeg, pend, t, pack_);
+        canonicalise(t, t + (pend - pbeg - ksize_ + 1));
+    }
 }
 
 template <typename kmer_t>
 void
 kmer_encoder<kmer_t>::encode(const std::string& s, kmer_t* t) const
 {
-    if (s.size() >= ksize_)
-        encode_(s.data(), s.data() + s.size(), t);
+    encode(s.data(), s.data() + s.size(), t);
 }
 
 template <typename kmer_t>
 void
 kmer_encoder<kmer_t>::encode(std::string &&s, kmer_t* t) const
 {
-    if (s.size() >= ksize_)
-        encode_(s.data(), s.data() + s.size(), t);
+    encode(s.data(), s.data() + s.size(), t);
+}
+
+template <typename kmer_t>
+void
+kmer_encoder<kmer_t>::encode(const packed_dna& d, kmer_t* t) const
+{
+    encode(d, 0, d.size, t);
+}
+
+template <typename kmer_t>
+void
+kmer_encoder<kmer_t>::encode(const packed_dna& d, size_t pos, size_t n, kmer_t* t) const
+{
+    if (n >= ksize_ && pos <= d.size && n <= d.size - pos) {
+        word_encode_(d, pos, n, t);
+        canonicalise(t, t + (n - ksize_ + 1));
+    }
 }
 
 template <typename kmer_t>
@@ -140,7 +207,7 @@ kmer_encoder<kmer_t>::encode(const std::string& s) const
 
     if (s.size() >= ksize_) {
         v.resize(s.size() - ksize_ + 1);
-        encode_(s.data(), s.data() + s.size(), v.data());
+        encode(s.data(), s.data() + s.size(), v.data());
     }
 
     return v;
@@ -153,20 +220,69 @@ kmer_encoder<kmer_t>::encode(std::string&& s) const
     return encode((const std::string&)s);
 }
 
+template <typename kmer_t>
+std::vector<kmer_t>
+kmer_encoder<kmer_t>::encode(const packed_dna& d) const
+{
+    std::vector<kmer_t> v;
+
+    if (d.size >= ksize_) {
+        v.resize(d.size - ksize_ + 1);
+        encode(d, v.data());
+    }
+
+    return v;
+}
+
 template <typename kmer_t>
 kmer_t
 kmer_encoder<kmer_t>::encode_kmer(const char *s) const
 {
     kmer_t kmer;
-    encode_(s, s+ksize_, &kmer);
+    encode(s, s+ksize_, &kmer);
     return kmer;
 }
 
+template <typename kmer_t>
+void
+kmer_encoder<kmer_t>::canonicalise(kmer_t *begin, kmer_t *end) const
+{
+    if (canon_)
+        canon_(begin, end);
+}
+
 template <typename kmer_t>
 std::string
 kmer_encoder<kmer_t>::decode(kmer_t kmer, bool rc) const
 {
-    return decode_(kmer, rc);
+    std::string result(ksize_, 'X');
+    decode_(kmer, &result[0], rc);
+    return result;
+}
+
+template <typename kmer_t>
+char*
+kmer_encoder<kmer_t>::decode(kmer_t kmer, char *p, bool rc) const
+{
+    return decode_(kmer, p, rc);
+}
+
+template <typename kmer_t>
+char*
+kmer_encoder<kmer_t>::decode(const kmer_t *begin, const kmer_t *end, char *p, bool rc) const
+{
+    while (begin != end)
+        p = decode_(*begin++, p, rc);
+    return p;
+}
+
+template <typename kmer_t>
+void
+kmer_encoder<kmer_t>::append_decoded(std::string& buf, kmer_t kmer) const
+{
+    size_t n = buf.size();
+    buf.resize(n + ksize_);
+    decode_(kmer, &buf[n], false);
 }
 
 
@@ -0,0 +1,137 @@
+/* numautils.cpp
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <string>
+#include "numautils.h"
+#include "utils.h"
+
+#ifndef NO_NUMA
+#include <numa.h>
+#endif
+
+namespace kfc {
+
+
+#ifndef NO_NUMA
+
+unsigned
+get_numa_nodes()
+{
+    static const unsigned n_nodes = numa_available() < 0 ? 1 : numa_max_node() + 1;
+    return n_nodes;
+}
+
+std::string
+get_numa_cpus(unsigned node)
+{
+    std::string res;
+
+    if (numa_available() < 0)
+        return res;
+
+    struct bitmask *cpus = numa_allocate_cpumask();
+
+    if (numa_node_to_cpus(node, cpus) == 0) {
+
+        // write as ranges, e.g. "0-7,16-23"
+
+        unsigned n = numa_num_possible_cpus();
+        for (unsigned i = 0; i < n; ++i) {
+            if (numa_bitmask_isbitset(cpus, i)) {
+                unsigned j = i;
+                while (j + 1 < n && numa_bitmask_isbitset(cpus, j + 1))
+                    ++j;
+                if (!res.empty())
+                    res += ',';
+                res += std::to_string(i);
+                if (j > i)
+                    res += '-' + std::to_string(j);
+                i = j;
+            }
+        }
+    }
+
+    numa_free_cpumask(cpus);
+    return res;
+}
+
+void *
+interleaved_calloc(size_t bytes)
+{
+    if (get_numa_nodes() > 1 && bytes >= interleave_min_bytes) {
+        verbose_emit("interleaving %luMB over %u NUMA nodes", bytes >> 20, get_numa_nodes());
+        return numa_alloc_interleaved(bytes);  // mmap'ed, hence zeroed
+    }
+
+    return std::calloc(bytes, 1);
+}
+
+void
+interleaved_free(void *p, size_t bytes)
+{
+    if (get_numa_nodes() > 1 && bytes >= interleave_min_bytes)
+        ::numa_free(p, bytes);
+    else
+        std::free(p);
+}
+
+bool
+bind_to_node(unsigned node)
+{
+    return numa_available() >= 0 && numa_run_on_node(node) == 0;
+}
+
+#else // NO_NUMA
+
+unsigned
+get_numa_nodes()
+{
+    return 1;
+}
+
+std::string
+get_numa_cpus(unsigned)
+{
+    return std::string();
+}
+
+void *
+interleaved_calloc(size_t bytes)
+{
+    return std::calloc(bytes, 1);
+}
+
+void
+interleaved_free(void *p, size_t)
+{
+    std::free(p);
+}
+
+bool
+bind_to_node(unsigned)
+{
+    return false;
+}
+
+#endif // NO_NUMA
+
+
+} // namespace kfc
+
+// vim: sts=4:sw=4:ai:si:et
@@ -0,0 +1,59 @@
+/* numautils.h
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef numautils_h_INCLUDED
+#define numautils_h_INCLUDED
+
+#include <cstddef>
+#include <string>
+
+namespace kfc {
+
+
+// NUMA utilities - memory and thread placement on multi-socket machines
+//
+// On a machine with more than one NUMA node, memory is local to one node
+// and remote to the others.  A large tally vector that is allocated the
+// usual way ends up on the node that first touches it, so that all other
+// nodes pay the interconnect price on every increment.
+//
+// interleaved_calloc() returns zeroed memory whose pages are interleaved
+// across all nodes, if there is more than one and the size is at least
+// interleave_min_bytes, and plain calloc() memory otherwise.  The memory
+// must be released with interleaved_free(), passing the same size.
+//
+// bind_to_node() restricts the calling thread to the CPUs of a node, so
+// that a pool of workers can be spread evenly over the nodes.
+//
+// Without libnuma (when compiled with NO_NUMA), the machine is taken to be
+// a single node.
+//
+constexpr size_t interleave_min_bytes = 1UL << 26;
+
+extern unsigned get_numa_nodes();
+extern std::string get_numa_cpus(unsigned node);
+
+extern void *interleaved_calloc(size_t bytes);
+extern void interleaved_free(void *p, size_t bytes);
+
+extern bool bind_to_node(unsigned node);
+
+
+} // namespace kfc
+
+#endif // numautils_h_INCLUDED
+       // vim: sts=4:sw=4:ai:si:et
@@ -0,0 +1,147 @@
+/* pipeline.cpp
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pipeline.h"
+#include "utils.h"
+
+namespace kfc {
+
+
+counting_pipeline::counting_pipeline(kmer_counter& counter, unsigned n_threads)
+    : counter_(counter),
+      n_threads_(n_threads ? n_threads : 1),
+      batch_size_(0)
+{
+    if (n_threads_ > 1) {
+        verbose_emit("starting %u counting threads", n_threads_);
+        pool_.reset(new task_pool<batch_t>(n_threads_, batches_per_thread * n_threads_,
+                    [this](batch_t& batch) { run(batch); }));
+    }
+}
+
+counting_pipeline::~counting_pipeline()
+{
+    finish();
+}
+
+void
+counting_pipeline::process(std::string&& data)
+{
+    if (!pool_) {
+        counter_.process(std::move(data));
+        return;
+    }
+
+    // cut long sequences in chunks that overlap by k-1, so that every
+    // k-mer starts in exactly one chunk; the last chunk takes up to
+    // chunk_slack bases more, rather than splitting off a small tail
+
+    size_t overlap = counter_.ksize() - 1;
+    size_t pos = 0;
+
+    for (; data.size() - pos > chunk_bases + chunk_slack + overlap; pos += chunk_bases)
+        add_to_batch(data.substr(pos, chunk_bases + overlap));
+
+    if (pos)
+        add_to_batch(data.substr(pos));
+    else
+        add_to_batch(std::move(data));
+}
+
+void
+counting_pipeline::process(packed_dna&& data)
+{
+    if (!pool_) {
+        counter_.process(data);
+        return;
+    }
+
+    size_t overlap = counter_.ksize() - 1;
+    size_t pos = 0;
+
+    for (; data.size - pos > chunk_bases + chunk_slack + overlap; pos += chunk_bases) {
+        packed_dna chunk;
+        chunk.assign(data, pos, chunk_bases + overlap);
+        add_to_batch(std::move(chunk));
+    }
+
+    if (pos) {
+        packed_dna chunk;
+        chunk.assign(data, pos, data.size - pos);
+        add_to_batch(std::move(chunk));
+    }
+    else
+        add_to_batch(std::move(data));
+}
+
+void
+counting_pipeline::add_to_batch(std::string&& data)
+{
+    batch_size_ += data.size();
+    batch_.data.push_back(std::move(data));
+    submit_if_full();
+}
+
+void
+counting_pipeline::add_to_batch(packed_dna&& data)
+{
+    batch_size_ += data.size;
+    batch_.packed.push_back(std::move(data));
+    submit_if_full();
+}
+
+void
+counting_pipeline::submit_if_full()
+{
+    if (batch_size_ >= batch_bases) {
+        pool_->submit(std::move(batch_));
+        batch_ = batch_t();
+        batch_size_ = 0;
+    }
+}
+
+void
+counting_pipeline::finish()
+{
+    if (!pool_)
+        return;
+
+    if (!batch_.data.empty() || !batch_.packed.empty())
+        pool_->submit(std::move(batch_));
+
+    batch_ = batch_t();
+    batch_size_ = 0;
+
+    pool_->finish();
+    pool_.reset();
+}
+
+void
+counting_pipeline::run(batch_t& batch)
+{
+    for (auto& data : batch.data)
+        counter_.process(std::move(data));
+
+    for (const auto& data : batch.packed)
+        counter_.process(data);
+}
+
+
+} // namespace kfc
+
+// vim: sts=4:sw=4:ai:si:et
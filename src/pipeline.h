@@ -0,0 +1,103 @@
+/* pipeline.h
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef pipeline_h_INCLUDED
+#define pipeline_h_INCLUDED
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "kmercounter.h"
+#include "taskpool.h"
+
+namespace kfc {
+
+
+// counting_pipeline - feeds sequences to a kmer_counter on worker threads
+//
+// The pipeline decouples reading from counting.  The thread that owns the
+// pipeline (the reader) calls process() for each sequence it has parsed.
+// The pipeline collects short sequences in batches of about batch_bases, and
+// submits the batches as tasks to a work-stealing task_pool of n_threads
+// workers, each of which runs the counter's process() (that is: encode and
+// tally) on every sequence in the batch.
+//
+// Sequences longer than chunk_bases are cut into chunks that overlap by k-1
+// bases, so that several threads can encode one long sequence (such as a
+// chromosome), while each k-mer is still counted exactly once.  The last
+// chunk may be up to chunk_slack bases longer, so that a sequence just over
+// the chunk size, such as a chunk from the reader (which ends at a line
+// end), is not split into a full chunk and a tiny one.  Tasks thus
+// are of similar size whether the input has short reads, long reads, or
+// assemblies, and idle workers steal tasks from busy ones.  The reader
+// can do this chunking as it reads (see sequence_reader::set_chunking), so
+// that encoding can start before the complete sequence has been read.
+//
+// Sequences can be passed as strings or packed (see packed_dna), in any mix.
+//
+// With n_threads == 1 no workers are started and process() is passed
+// straight on to the counter on the calling thread, which is exactly the
+// single threaded behaviour.
+//
+// Call finish() after the last sequence.  It flushes the pending batch and
+// waits for the workers to complete, after which the counter's results can
+// be written.  The destructor calls finish() if it was not called.
+//
+class counting_pipeline {
+
+    public:
+        constexpr static size_t batch_bases = 1UL << 20;
+        constexpr static size_t batches_per_thread = 2;
+        constexpr static size_t chunk_bases = 1UL << 20;
+        constexpr static size_t chunk_slack = chunk_bases / 4;
+
+    private:
+        struct batch_t {
+            std::vector<std::string> data;
+            std::vector<packed_dna> packed;
+        };
+
+        kmer_counter& counter_;
+        unsigned n_threads_;
+        std::unique_ptr<task_pool<batch_t>> pool_;
+        batch_t batch_;
+        size_t batch_size_;
+
+    public:
+        counting_pipeline(kmer_counter& counter, unsigned n_threads);
+        counting_pipeline(const counting_pipeline&) = delete;
+        counting_pipeline& operator=(const counting_pipeline&) = delete;
+        ~counting_pipeline();
+
+        unsigned n_threads() const { return n_threads_; }
+
+        void process(std::string&& data);
+        void process(packed_dna&& data);
+        void finish();
+
+    private:
+        void add_to_batch(std::string&& data);
+        void add_to_batch(packed_dna&& data);
+        void submit_if_full();
+        void run(batch_t& batch);
+};
+
+
+} // namespace kfc
+
+#endif // pipeline_h_INCLUDED
+       // vim: sts=4:sw=4:ai:si:et
@@ -0,0 +1,364 @@
+/* radixsort.h
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef radixsort_h_INCLUDED
+#define radixsort_h_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "bitfiddle.h"
+#include "utils.h"
+
+namespace kfc {
+
+
+// radix_sort - sort an array of encoded k-mers in place, on multiple threads
+//
+// Sorts the kmer_t values in [begin,end) ascending, given that every valid
+// value fits in nbits bits, and every invalid value has its high bit set (as
+// produced by kmer_encoder).  The invalid values all end up after the valid
+// ones, in unspecified order.
+//
+// This is an in-place MSD (most significant digit first) radix sort, so it
+// needs no memory beyond the array, and it does only as many passes as there
+// are digits in nbits (which is 2k-!s for k-mers), rather than bitsize.
+//
+// The first pass partitions the array on its top top_bits bits, plus one
+// extra bucket for invalid values.  Its histogram is computed in parallel,
+// and so is its permutation, in place, in rounds (as in PARADIS): each thread
+// gets a stripe of every bucket and permutes among its own stripes, leaving
+// a value where it finds the stripe it belongs in full; a repair step then
+// moves the values left in a wrong bucket to the end of that bucket, and the
+// next round permutes what remains.  The resulting buckets are then sorted
+// independently on n_threads threads, each recursing on 8-bit digits,
+// largest buckets first.
+//
+template <typename kmer_t>
+void radix_sort(kmer_t *begin, kmer_t *end, unsigned nbits, unsigned n_threads = 1);
+
+
+// implementation ------------------------------------------------------------
+
+namespace radix_detail {
+
+constexpr unsigned top_bits = 11;       // first pass has up to 2^11+1 buckets
+constexpr unsigned digit_bits = 8;      // subsequent passes 2^8 buckets
+constexpr size_t small_size = 64;       // below this, use insertion sort
+constexpr size_t serial_size = 1UL << 16;   // below this, use one thread
+
+// insertion_sort - for the tiny buckets at the bottom of the recursion
+//
+template <typename kmer_t>
+void
+insertion_sort(kmer_t *begin, kmer_t *end)
+{
+    for (kmer_t *p = begin + 1; p < end; ++p) {
+        kmer_t v = *p;
+        kmer_t *q = p;
+        while (q != begin && v < *(q-1)) {
+            *q = *(q-1);
+            --q;
+        }
+        *q = v;
+    }
+}
+
+// permute_ranges - american flag permutation into n buckets, where bucket
+//                  b is to be filled at [heads[b],tails[b]), and these
+//                  ranges together hold exactly the values that go there
+//
+template <typename kmer_t, typename digit_fn>
+void
+permute_ranges(kmer_t *begin, size_t *heads, const size_t *tails, unsigned n, digit_fn dig)
+{
+    for (unsigned b = 0; b != n; ++b) {
+        while (heads[b] < tails[b]) {
+            kmer_t v = begin[heads[b]];
+            unsigned d = dig(v);
+            while (d != b) {
+                std::swap(v, begin[heads[d]++]);
+                d = dig(v);
+            }
+            begin[heads[b]++] = v;
+        }
+    }
+}
+
+// permute - american flag permutation of [begin,end) into n buckets,
+//           given bucket sizes in count, using digit function dig
+//
+template <typename kmer_t, typename digit_fn>
+void
+permute(kmer_t *begin, const size_t *count, unsigned n, size_t *heads, digit_fn dig)
+{
+    std::vector<size_t> tails(n);
+
+    size_t pos = 0;
+    for (unsigned b = 0; b != n; ++b) {
+        heads[b] = pos;
+        pos += count[b];
+        tails[b] = pos;
+    }
+
+    permute_ranges(begin, heads, tails.data(), n, dig);
+}
+
+// parallel_permute - permute as above, on n_threads threads
+//
+template <typename kmer_t, typename digit_fn>
+void
+parallel_permute(kmer_t *begin, const size_t *count, unsigned n, digit_fn dig, unsigned n_threads)
+{
+    // bucket b still has to be filled at [heads[b],tails[b])
+
+    std::vector<size_t> heads(n), tails(n);
+
+    size_t pos = 0;
+    for (unsigned b = 0; b != n; ++b) {
+        heads[b] = pos;
+        pos += count[b];
+        tails[b] = pos;
+    }
+
+    // a thread permutes its stripe of every bucket's remainder; where the
+    // stripe of the value it holds is full, it drops it in the current one
+
+    auto stripes = [begin, n, n_threads, &heads, &tails, &dig](unsigned t) {
+        std::vector<size_t> h(n), e(n);
+        for (unsigned b = 0; b != n; ++b) {
+            size_t r = tails[b] - heads[b];
+            h[b] = heads[b] + r * t / n_threads;
+            e[b] = heads[b] + r * (t+1) / n_threads;
+        }
+        for (unsigned b = 0; b != n; ++b) {
+            while (h[b] < e[b]) {
+                kmer_t v = begin[h[b]];
+                unsigned d = dig(v);
+                while (d != b && h[d] < e[d]) {
+                    std::swap(v, begin[h[d]++]);
+                    d = dig(v);
+                }
+                begin[h[b]++] = v;
+            }
+        }
+    };
+
+    // the repair moves the values dropped in a wrong bucket to its end,
+    // which leaves that end as the bucket's remainder
+
+    std::atomic<unsigned> next;
+
+    auto repair = [begin, n, &heads, &tails, &dig, &next] {
+        unsigned b;
+        while ((b = next.fetch_add(1)) < n) {
+            size_t i = heads[b], j = tails[b];
+            while (i < j) {
+                if (dig(begin[i]) == b)
+                    ++i;
+                else
+                    std::swap(begin[i], begin[--j]);
+            }
+            heads[b] = i;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    size_t left = pos;
+
+    while (left >= serial_size) {
+
+        for (unsigned t = 1; t < n_threads; ++t)
+            threads.emplace_back(stripes, t);
+        stripes(0);
+        for (auto& t : threads)
+            t.join();
+        threads.clear();
+
+        next = 0;
+        for (unsigned t = 1; t < n_threads; ++t)
+            threads.emplace_back(repair);
+        repair();
+        for (auto& t : threads)
+            t.join();
+        threads.clear();
+
+        size_t was_left = left;
+        left = 0;
+        for (unsigned b = 0; b != n; ++b)
+            left += tails[b] - heads[b];
+
+        if (left == was_left)   // no progress, leave it to the serial finish
+            break;
+    }
+
+    // finish the few values that are left on this thread
+
+    permute_ranges(begin, heads.data(), tails.data(), n, dig);
+}
+
+// sort_bucket - recursively sort [begin,end) on its low nbits bits,
+//               all higher bits being equal across the bucket
+//
+template <typename kmer_t>
+void
+sort_bucket(kmer_t *begin, kmer_t *end, unsigned nbits)
+{
+    size_t n = end - begin;
+
+    if (n < 2 || nbits == 0)
+        return;
+
+    if (n < small_size) {
+        insertion_sort(begin, end);
+        return;
+    }
+
+    unsigned width = nbits < digit_bits ? nbits : digit_bits;
+    unsigned shift = nbits - width;
+    unsigned n_buckets = 1U << width;
+    kmer_t mask = n_buckets - 1;
+
+    size_t count[1U << digit_bits] = { 0 };
+    size_t heads[1U << digit_bits];
+
+    for (kmer_t *p = begin; p != end; ++p)
+        ++count[(*p >> shift) & mask];
+
+    permute(begin, count, n_buckets, heads,
+            [shift, mask](kmer_t v) { return static_cast<unsigned>((v >> shift) & mask); });
+
+    if (shift) {
+        size_t pos = 0;
+        for (unsigned b = 0; b != n_buckets; ++b) {
+            sort_bucket(begin + pos, begin + pos + count[b], shift);
+            pos += count[b];
+        }
+    }
+}
+
+} // namespace radix_detail
+
+template <typename kmer_t>
+void
+radix_sort(kmer_t *begin, kmer_t *end, unsigned nbits, unsigned n_threads)
+{
+    static_assert(std::is_unsigned<kmer_t>::value,
+            "template argument kmer_t must be unsigned integral");
+
+    using namespace radix_detail;
+
+    if (nbits < 1 || nbits >= bitsize<kmer_t>)
+        raise_error("invalid number of bits for radix sort: %u", nbits);
+
+    size_t n = end - begin;
+
+    if (n < 2)
+        return;
+
+    if (n_threads < 1 || n < serial_size)
+        n_threads = 1;
+
+    // the first pass partitions on the top bits, invalids in the last bucket
+
+    const unsigned width = nbits < top_bits ? nbits : top_bits;
+    const unsigned shift = nbits - width;
+    const unsigned n_valid = 1U << width;
+    const unsigned n_buckets = n_valid + 1;
+
+    auto dig = [shift, n_valid](kmer_t v) {
+        return (v & high_bit<kmer_t>) ? n_valid : static_cast<unsigned>(v >> shift);
+    };
+
+    // compute the histogram in parallel over n_threads chunks of the array
+
+    std::vector<size_t> count(n_buckets, 0);
+    std::vector<std::vector<size_t>> counts(n_threads, std::vector<size_t>(n_buckets, 0));
+    std::vector<std::thread> threads;
+
+    auto histogram = [&counts, &dig, begin, n, n_threads](unsigned t) {
+        size_t *c = counts[t].data();
+        kmer_t *p = begin + n * t / n_threads;
+        kmer_t *pend = begin + n * (t+1) / n_threads;
+        while (p != pend)
+            ++c[dig(*p++)];
+    };
+
+    for (unsigned t = 1; t < n_threads; ++t)
+        threads.emplace_back(histogram, t);
+
+    histogram(0);
+
+    for (auto& t : threads)
+        t.join();
+
+    threads.clear();
+
+    for (unsigned t = 0; t != n_threads; ++t)
+        for (unsigned b = 0; b != n_buckets; ++b)
+            count[b] += counts[t][b];
+
+    // partition in place into the buckets
+
+    if (n_threads > 1)
+        parallel_permute(begin, count.data(), n_buckets, dig, n_threads);
+    else {
+        std::vector<size_t> heads(n_buckets);
+        permute(begin, count.data(), n_buckets, heads.data(), dig);
+    }
+
+    if (!shift)
+        return;
+
+    // sort the valid buckets in parallel, the largest first
+
+    std::vector<std::pair<kmer_t*,kmer_t*>> todo;
+
+    size_t pos = 0;
+    for (unsigned b = 0; b != n_valid; ++b) {
+        if (count[b] > 1)
+            todo.emplace_back(begin + pos, begin + pos + count[b]);
+        pos += count[b];
+    }
+
+    std::sort(todo.begin(), todo.end(),
+            [](const std::pair<kmer_t*,kmer_t*>& a, const std::pair<kmer_t*,kmer_t*>& b) {
+                return (a.second - a.first) > (b.second - b.first); });
+
+    std::atomic<size_t> next(0);
+
+    auto work = [&todo, &next, shift] {
+        size_t i;
+        while ((i = next.fetch_add(1)) < todo.size())
+            sort_bucket(todo[i].first, todo[i].second, shift);
+    };
+
+    for (unsigned t = 1; t < n_threads; ++t)
+        threads.emplace_back(work);
+
+    work();
+
+    for (auto& t : threads)
+        t.join();
+}
+
+
+} // namespace kfc
+
+#endif // radixsort_h_INCLUDED
+       // vim: sts=4:sw=4:ai:si:et
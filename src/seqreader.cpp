@@ -32,12 +32,16 @@ namespace kfc {
 
 sequence_reader::sequence_reader(std::istream &is, mode_t mode)
 #ifdef NO_ZLIB
-    : is_(is), lineno_(0), mode_(mode)
+    : is_(is), lineno_(0), mode_(mode),
+      chunk_len_(0), chunk_overlap_(0), in_chunk_(false), chunk_offset_(0),
+      packing_(false)
 {
     if (is.peek() == 0x1f)
         raise_error("no decompression support");
 #else
-    : lineno_(0), mode_(mode)
+    : lineno_(0), mode_(mode),
+      chunk_len_(0), chunk_overlap_(0), in_chunk_(false), chunk_offset_(0),
+      packing_(false)
 {
     if (is.peek() == 0x1f)
     {
@@ -79,6 +83,16 @@ sequence_reader::next_line()
     return false;
 }
 
+void
+sequence_reader::set_chunking(std::string::size_type len, std::string::size_type overlap)
+{
+    if (len && overlap >= len)
+        raise_error("chunk overlap (%lu) must be less than chunk length (%lu)", overlap, len);
+
+    chunk_len_ = len;
+    chunk_overlap_ = overlap;
+}
+
 bool
 sequence_reader::next(sequence &seq)
 {
@@ -92,6 +106,11 @@ sequence_reader::next(sequence &seq)
         default: raise_error("programmer error 42: unhandled case");
     }
 
+    if (packing_) {
+        seq.packed.assign(seq.data.data(), seq.data.size());
+        seq.data.clear();
+    }
+
     return true;
 }
 
@@ -100,9 +119,14 @@ sequence_reader::read_bare(sequence &seq)
 {
     static const std::string ANONYMOUS("(anonymous)");
 
-    seq.id = ANONYMOUS;
-    seq.header.clear();
-    seq.data = line_;
+    if (in_chunk_)
+        continue_chunk(seq);
+    else {
+        seq.id = ANONYMOUS;
+        seq.header.clear();
+        seq.data = line_;
+        start_chunk(seq);
+    }
 
     while (next_line()) {
 
@@ -110,34 +134,50 @@ sequence_reader::read_bare(sequence &seq)
         while ((pos = line_.find(' ', pos)) != std::string::npos)
             line_.erase(pos, 1);
 
+        if (chunk_full(seq))
+            return;
+
         seq.data.append(line_);
     }
+
+    in_chunk_ = false;
 }
 
 void
 sequence_reader::read_fasta(sequence &seq)
 {
-    seq.header = line_;
-
-    std::string::const_iterator p = line_.begin() + 1;
-    while (p != line_.end() && !std::isspace(*p))
-        ++p;
-    seq.id = std::string(line_, 1, p - line_.begin() - 1);
-
-    seq.data.clear();
+    if (in_chunk_)
+        continue_chunk(seq);
+    else {
+        seq.header = line_;
+
+        std::string::const_iterator p = line_.begin() + 1;
+        while (p != line_.end() && !std::isspace(*p))
+            ++p;
+        seq.id = std::string(line_, 1, p - line_.begin() - 1);
+
+        seq.data.clear();
+        start_chunk(seq);
+    }
 
     while (next_line())
     {
         if (line_[0] == '>')
             break;
 
+        if (chunk_full(seq))
+            return;
+
         seq.data.append(line_);
     }
+
+    in_chunk_ = false;
 }
 
 void
 sequence_reader::read_fastq(sequence &seq)
 {
+    seq.offset = 0;
     seq.header = line_;
 
     std::string::const_iterator p = line_.begin() + 1;
@@ -160,6 +200,47 @@ sequence_reader::read_fastq(sequence &seq)
         raise_error("line %d: invalid fastq, header line should start with '@'", lineno_);
 }
 
+// chunking ----------------------------------------------------------------
+
+void
+sequence_reader::start_chunk(sequence &seq)
+{
+    seq.offset = 0;
+
+    if (chunk_len_) {
+        chunk_header_ = seq.header;
+        chunk_id_ = seq.id;
+    }
+}
+
+void
+sequence_reader::continue_chunk(sequence &seq)
+{
+    seq.header = chunk_header_;
+    seq.id = chunk_id_;
+    seq.data.swap(chunk_carry_);
+    seq.data.append(line_);
+    seq.offset = chunk_offset_;
+}
+
+bool
+sequence_reader::chunk_full(sequence &seq)
+{
+    std::string::size_type len = seq.data.size();
+
+    if (!chunk_len_ || len < chunk_len_)
+        return false;
+
+    // the sequence continues in line_, which is left pending for the next
+    // chunk, which starts with the overlap bases at the end of this one
+
+    chunk_carry_.assign(seq.data, len - chunk_overlap_, chunk_overlap_);
+    chunk_offset_ = seq.offset + len - chunk_overlap_;
+    in_chunk_ = true;
+
+    return true;
+}
+
 
 } // namespace kfc
 
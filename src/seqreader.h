@@ -21,6 +21,7 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include "basepack.h"
 
 #ifndef NO_ZLIB
 #  include <boost/iostreams/filtering_stream.hpp>
@@ -35,6 +36,10 @@ struct sequence {
     std::string header;  // full header of the sequence, including '>' or '@'
     std::string id;      // whatever is between '>' or '@' and the first space
     std::string data;    // the sequence data, collated into a single line
+    packed_dna packed;   // the sequence data packed, instead of data, when
+                         // set_packing is on
+    std::string::size_type offset;  // position of data in the sequence (see
+                                    // set_chunking), normally 0
 };
 
 
@@ -58,6 +63,20 @@ struct sequence {
 // The reader does not validate the content of the sequences.  It passes
 // through all characters, except for whitespace which it strips in bare mode.
 //
+// When set_chunking(len, overlap) has been called, then FASTA and bare
+// sequences longer than len are returned in chunks: consecutive calls to
+// next() return pieces of about len bases (at least len, plus at most one
+// line) that overlap by overlap bases.  Each chunk has the header and ID of
+// its sequence, and its offset in the sequence.  With overlap set to k-1,
+// every k-mer in the sequence occurs in exactly one chunk.  This bounds the
+// memory taken by, for instance, whole chromosomes, and lets processing of a
+// sequence start before it has been read completely.
+//
+// When set_packing(true) has been called, next() returns the sequence data
+// in packed (at 2 bits per base, see packed_dna), and leaves data empty.
+// Records then take a quarter of the memory on their way to the encoder,
+// which reads the packed bases without validating them again.
+//
 class sequence_reader {
 
     public:
@@ -72,16 +91,29 @@ class sequence_reader {
         std::string line_;
         int lineno_;
         mode_t mode_;
+        std::string::size_type chunk_len_;
+        std::string::size_type chunk_overlap_;
+        bool in_chunk_;
+        std::string chunk_header_;
+        std::string chunk_id_;
+        std::string chunk_carry_;
+        std::string::size_type chunk_offset_;
+        bool packing_;
 
     public:
         sequence_reader(std::istream&, mode_t = detect);
         bool next(sequence&);
+        void set_chunking(std::string::size_type len, std::string::size_type overlap);
+        void set_packing(bool packing) { packing_ = packing; }
 
     protected:
         bool next_line();
         void read_bare(sequence&);
         void read_fasta(sequence&);
         void read_fastq(sequence&);
+        void start_chunk(sequence&);
+        void continue_chunk(sequence&);
+        bool chunk_full(sequence&);
 };
 
 
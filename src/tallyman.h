@@ -18,15 +18,42 @@
 #ifndef tallyman_h_INCLUDED
 #define tallyman_h_INCLUDED
 
+#include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <memory>
 #include <vector>
 #include <cstring>
+#include <deque>
 #include <map>
+#include <mutex>
+#include <thread>
+#include "bitfiddle.h"
+#include "numautils.h"
 #include "utils.h"
 
+// KFC_PREFETCH_DISTANCE - how many items ahead a tally of a block of items
+// prefetches the cell it will increment; tuned on x86-64, override with -D if
+// needed, 0 turns prefetching off
+
+#ifndef KFC_PREFETCH_DISTANCE
+#if defined(__aarch64__)
+#define KFC_PREFETCH_DISTANCE 64
+#else
+#define KFC_PREFETCH_DISTANCE 32
+#endif
+#endif
+
 namespace kfc {
 
+// tally_prefetch_distance, tally_prefetch_bytes - the counting engine, when it
+// tallies a block of items, prefetches the cell of the item that is
+// tally_prefetch_distance ahead, if the tallyman's prefetches() says that
+// its cells take at least tally_prefetch_bytes (else they are in cache)
+
+constexpr size_t tally_prefetch_distance = KFC_PREFETCH_DISTANCE;
+constexpr size_t tally_prefetch_bytes = 32UL << 20;
+
 
 // tallyman - keeps counts of encoded kmers, or generally of any
 //            unsigned integral type of a specified maximum number of bits
@@ -34,12 +61,27 @@ namespace kfc {
 // Tallyman has implementations with different space and time characteristics.
 // Given B=nbits the bit size of the items to be tallied, N the number of
 // values tallied, and C the size of count_t, then:
-// - tallyman_vec uses a linear array, with O(1) lookup and C*2^B memory;
-// - tallyman_map uses a map, with O(log N) lookup and O(N) storage
+// - tallyman_vec uses a linear array, with O(1) lookup and C*2^B memory,
+//   which when large is interleaved across NUMA nodes (see numautils.h);
+// - tallyman_vec_atomic is tallyman_vec with lock-free concurrent tallying;
+// - tallyman_vec_private gives each thread its own tallyman_vec, summed at end;
+// - tallyman_vec_blocked is tallyman_vec that first partitions the items on
+//   their high bits, then tallies them a cache-sized region at a time;
+// - tallyman_map uses a map, with O(log N) lookup and O(N) storage;
+// - tallyman_map_sharded splits the map in 2^S shards for concurrent tallying
+// - tallyman_hash uses an open addressing hash table, with O(1) lookup and
+//   O(N) storage, that is sorted once all tallying is done
+// - tallyman_vec_compact is a linear array of 8 or 16-bit cells, which spill
+//   the counts beyond their range into a tallyman_hash
+// - tallyman_bits is a linear array of 1-bit cells, that record presence, or
+//   of 2-bit cells, that count up to 3 and stay there
 //
-// The core operation is tally(items), which tallies each i in items by either
-// incrementing its item count, or incrementing the invalid_count if i exceeds
-// max_value, the largest possible nbit number.
+// The core operation is tally(begin, end), which tallies each i in the range
+// by either incrementing its item count, or incrementing the invalid_count if
+// i exceeds max_value, the largest possible nbit number.  The tally(items)
+// members do the same for a vector of items.  The add_invalid(n) member adds
+// n to the invalid count at once, for callers that skip invalid items rather
+// than tally them one by one (see packed_dna::for_each_valid).
 //
 // Template parameter value_t must be an unsigned integral type of at least
 // nbits bits (or the program exits).  If its bit size equals nbits, then
@@ -53,7 +95,29 @@ namespace kfc {
 // The get_results_X() members return the tallied counts.  For performance
 // reasons, these members do not shield from the underlying implementation
 // (vector or map).  Use the is_vec() and is_map() selectors to find out
-// whether get_results_vec() or get_results_map() should be called.
+// whether get_results_vec() or get_results_map() should be called.  A map
+// implementation may consist of map_shards() maps which each hold a range of
+// the values, in order; get_results_shard(n) returns the n-th of these.  The
+// hash implementation (is_hash()) has get_results_hash(n), which returns its
+// n (value, count) entries as an array sorted on value.  The compact vector
+// and the bit vectors (is_compact()) have get_results_range(lo, n, out),
+// which writes the counts of values lo to lo+n-1 to out.  The count_cap()
+// member returns the highest count the bit vectors record (1 for presence
+// only), and 0 for the other implementations, which do not cap.
+//
+// The vector implementations also offer a non-virtual sink() member, for
+// callers that know the concrete type and want the tally of each item
+// inlined into their own loop (see countengine.h).  The sink() returns a
+// function object that tallies a valid item, and whose prefetch(i) member
+// prefetches the cell of item i.  Like add_invalid(), it has the same
+// concurrency as tally().  The non-virtual prefetches() member tells whether
+// the cells are so large that the caller should prefetch.
+//
+// Unless is_concurrent() returns true, tally() must not be invoked from
+// more than one thread at a time.  Once all tallying has completed, call
+// finish(), after which the get_results_X() members and invalid_count() can
+// be called.  Only implementations that tally into per-thread storage need
+// finish() to collect the results; it may be called more than once.
 //
 template <typename value_t, typename count_t>
 class tallyman {
@@ -72,15 +136,35 @@ class tallyman {
     public:
         virtual ~tallyman() { }
 
-	virtual void tally(std::vector<value_t> &&) = 0;
-	virtual void tally(const std::vector<value_t>&) = 0;
+        virtual void tally(const value_t *begin, const value_t *end) = 0;
+        virtual void add_invalid(count_t n) { n_invalid_ += n; }
+
+        void tally(const std::vector<value_t>& ii) { tally(ii.data(), ii.data() + ii.size()); }
+        void tally(std::vector<value_t>&& ii) { tally(ii.data(), ii.data() + ii.size()); }
 
         virtual bool is_vec() const { return false; }
         virtual bool is_map() const { return false; }
+        virtual bool is_hash() const { return false; }
+        virtual bool is_compact() const { return false; }
+        virtual bool is_concurrent() const { return false; }
+        virtual count_t count_cap() const { return 0; }
+
+        virtual void finish() { }
 
         virtual const count_t *get_results_vec() const = 0;
         virtual const std::map<value_t,count_t>& get_results_map() const = 0;
 
+        virtual unsigned map_shards() const { return 1; }
+        virtual const std::map<value_t,count_t>& get_results_shard(unsigned) const { return get_results_map(); }
+
+        struct entry {
+            value_t value;
+            count_t count;
+        };
+
+        virtual const entry *get_results_hash(size_t& n) const;
+        virtual void get_results_range(size_t lo, size_t n, count_t *out) const;
+
         value_t max_value() const { return max_value_; }
         count_t invalid_count() const { return n_invalid_; }
 };
@@ -93,19 +177,33 @@ class tallyman_vec : public tallyman<value_t,count_t>
     static_assert(std::is_integral<count_t>::value || std::is_floating_point<count_t>::value,
             "template argument count_t must be a numerical type");
 
-    private:
+    protected:
         count_t *vec_;
 
-        void tally(value_t i);
+    private:
+        void tally_one(value_t i);
 
     public:
         tallyman_vec<value_t,count_t>(int nbits);
         tallyman_vec<value_t,count_t>(const tallyman_vec&) = delete;
         tallyman_vec<value_t,count_t>& operator=(const tallyman_vec&) = delete;
-        virtual ~tallyman_vec<value_t,count_t>() { if (vec_) free(vec_); }
+        virtual ~tallyman_vec<value_t,count_t>();
 
-	virtual void tally(std::vector<value_t> &&);
-	virtual void tally(const std::vector<value_t>&);
+        using tallyman<value_t,count_t>::tally;
+        virtual void tally(const value_t *begin, const value_t *end);
+
+        struct sink_t {
+            count_t *vec;
+            void operator()(value_t i) const { ++vec[i]; }
+            void prefetch(value_t i) const { __builtin_prefetch(vec + i, 1); }
+        };
+
+        sink_t sink() { return sink_t { vec_ }; }
+
+        bool prefetches() const {
+            return tally_prefetch_distance &&
+                (static_cast<size_t>(tallyman<value_t,count_t>::max_value_) + 1) * sizeof(count_t) >= tally_prefetch_bytes;
+        }
 
         virtual bool is_vec() const { return true; }
 
@@ -113,6 +211,148 @@ class tallyman_vec : public tallyman<value_t,count_t>
         virtual const std::map<value_t,count_t>& get_results_map() const;
 };
 
+// tallyman_vec_atomic - tallyman_vec that can be tallied from many threads
+//
+// Increments the vector cells with relaxed atomic fetch-and-add, so that any
+// number of threads can tally into the same vector without a mutex.  Invalid
+// items are counted locally by each thread for the duration of the tally()
+// call, and added to the shared invalid count once at the end.  The count_t
+// must be integral (atomic floating point addition is not lock-free).
+//
+template <typename value_t, typename count_t>
+class tallyman_vec_atomic : public tallyman_vec<value_t,count_t>
+{
+    static_assert(std::is_integral<count_t>::value,
+            "template argument count_t must be integral for atomic tallying");
+
+    public:
+        tallyman_vec_atomic<value_t,count_t>(int nbits);
+
+        using tallyman<value_t,count_t>::tally;
+        virtual void tally(const value_t *begin, const value_t *end);
+
+        struct sink_t {
+            count_t *vec;
+            void operator()(value_t i) const { __atomic_fetch_add(vec + i, 1, __ATOMIC_RELAXED); }
+            void prefetch(value_t i) const { __builtin_prefetch(vec + i, 1); }
+        };
+
+        sink_t sink() { return sink_t { tallyman_vec<value_t,count_t>::vec_ }; }
+        virtual void add_invalid(count_t n) { __atomic_fetch_add(&(tallyman<value_t,count_t>::n_invalid_), n, __ATOMIC_RELAXED); }
+
+        virtual bool is_concurrent() const { return true; }
+};
+
+// tallyman_vec_private - tallyman_vec with a private vector for every thread
+//
+// Each thread that calls tally() gets a vector of its own, so that it can
+// tally without atomic operations, and without sharing cache lines with the
+// other threads.  The first thread uses the vector of the base class.  The
+// finish() member adds the other vectors into that one on n_threads threads,
+// each summing a range of the vector (in a loop the compiler vectorises),
+// and then frees them.  This takes up to n_threads times the memory of the
+// tallyman_vec, and so pays off only for small nbits.  As the private vectors
+// are first touched by their owning thread, they reside on its NUMA node.
+//
+template <typename value_t, typename count_t>
+class tallyman_vec_private : public tallyman_vec<value_t,count_t>
+{
+    private:
+        struct slot {
+            count_t *vec;
+            count_t n_invalid;
+        };
+
+        unsigned n_threads_;
+        unsigned long serial_;
+        std::mutex mutex_;
+        std::deque<slot> slots_;
+        std::map<std::thread::id, slot*> owners_;
+        bool finished_;
+
+        slot& my_slot();
+        static void add_vec(count_t *__restrict dst, const count_t *__restrict src, size_t n);
+
+    public:
+        tallyman_vec_private<value_t,count_t>(int nbits, unsigned n_threads);
+        virtual ~tallyman_vec_private<value_t,count_t>();
+
+        using tallyman<value_t,count_t>::tally;
+        virtual void tally(const value_t *begin, const value_t *end);
+
+        typedef typename tallyman_vec<value_t,count_t>::sink_t sink_t;
+
+        sink_t sink() { return sink_t { my_slot().vec }; }
+        virtual void add_invalid(count_t n) { my_slot().n_invalid += n; }
+
+        virtual bool is_concurrent() const { return true; }
+
+        virtual void finish();
+};
+
+// tallyman_vec_blocked - tallyman_vec that tallies one region at a time
+//
+// When the vector is much larger than the cache, nearly every increment of a
+// tallyman_vec misses both the cache and the TLB.  This class splits the
+// vector in 2^P regions of region_bytes (about the size of an L2 cache), and
+// first scatters the items into a buffer per region, selected by their high
+// bits.  When a buffer fills up, its bucket_len items are flushed as a burst
+// of increments into that one region, whose lines and pages then stay in
+// cache for the burst.  The buffers are written sequentially, and together
+// take 2^P*bucket_len items (4MB for 32-bit value_t), as P is at most
+// max_part_bits.  Beyond 2^P regions the regions grow, and the gain shrinks.
+// It pays off from vectors of about 64MB (nbits 24 for 32-bit count_t).
+//
+// The items left in the buffers are tallied by finish(), which must be
+// called before the results are read.  Items can still be tallied after
+// finish(), if it is called again.  As the buffers are shared, this class
+// is not concurrent.
+//
+template <typename value_t, typename count_t>
+class tallyman_vec_blocked : public tallyman_vec<value_t,count_t>
+{
+    private:
+        constexpr static size_t region_bytes = 256 * 1024;
+        constexpr static unsigned max_part_bits = 10;
+        constexpr static size_t bucket_len = 1024;
+
+        unsigned part_bits_;
+        unsigned shift_;
+        std::unique_ptr<value_t[]> buf_;
+        std::unique_ptr<value_t*[]> fill_;
+
+        void flush(size_t b);
+
+    public:
+        tallyman_vec_blocked<value_t,count_t>(int nbits);
+
+        using tallyman<value_t,count_t>::tally;
+        virtual void tally(const value_t *begin, const value_t *end);
+
+        void put(value_t i) {
+            value_t *&p = fill_[i >> shift_];
+            *p++ = i;
+            size_t n = p - buf_.get();
+            if (!(n & (bucket_len - 1)))
+                flush(n / bucket_len - 1);
+        }
+
+        struct sink_t {
+            tallyman_vec_blocked *tman;
+            void operator()(value_t i) const { tman->put(i); }
+            void prefetch(value_t) const { }
+        };
+
+        sink_t sink() { return sink_t { this }; }
+
+        // the regions are cache-sized, so there is nothing to prefetch
+        bool prefetches() const { return false; }
+
+        virtual void finish();
+
+        unsigned part_bits() const { return part_bits_; }
+};
+
 template<typename value_t, typename count_t>
 class tallyman_map : public tallyman<value_t,count_t>
 {
@@ -125,15 +365,15 @@ class tallyman_map : public tallyman<value_t,count_t>
         typedef typename std::map<value_t,count_t>::iterator iterator;
         std::map<value_t,count_t> map_;
 
-        void tally(value_t i);
+        void tally_one(value_t i);
 
     public:
         tallyman_map<value_t,count_t>(int nbits);
         tallyman_map<value_t,count_t>(const tallyman_map<value_t,count_t>&) = delete;
         tallyman_map<value_t,count_t>& operator=(const tallyman_map<value_t,count_t>&) = delete;
 
-        virtual void tally(std::vector<value_t>&&);
-        virtual void tally(const std::vector<value_t>&);
+        using tallyman<value_t,count_t>::tally;
+        virtual void tally(const value_t *begin, const value_t *end);
 
         virtual bool is_map() const { return true; }
 
@@ -141,11 +381,253 @@ class tallyman_map : public tallyman<value_t,count_t>
         virtual const std::map<value_t,count_t>& get_results_map() const { return map_; }
 };
 
+// tallyman_map_sharded - map tallyman that can be tallied from many threads
+//
+// Splits the value range in 2^shard_bits consecutive shards, each a map with
+// its own mutex.  The top shard_bits of a value select its shard.  A tally()
+// call first groups its items by shard, then takes each shard's lock once,
+// so that threads contend only when they hit the same shard at the same time.
+// As the shards partition the value range in order, reading the shards one
+// after the other gives the results in order, without a merge step.
+//
+template<typename value_t, typename count_t>
+class tallyman_map_sharded : public tallyman<value_t,count_t>
+{
+    static_assert(std::is_unsigned<value_t>::value,
+            "template argument value_t must be unsigned integral");
+    static_assert(std::is_integral<count_t>::value || std::is_floating_point<count_t>::value,
+            "template argument count_t must be a numerical type");
+
+    private:
+        typedef typename std::map<value_t,count_t>::iterator iterator;
+
+        struct shard {
+            std::map<value_t,count_t> map;
+            std::mutex mutex;
+        };
+
+        unsigned shard_bits_;
+        unsigned shard_shift_;
+        std::unique_ptr<shard[]> shards_;
+        std::mutex invalid_mutex_;
+
+    public:
+        tallyman_map_sharded<value_t,count_t>(int nbits, unsigned shard_bits);
+        tallyman_map_sharded<value_t,count_t>(const tallyman_map_sharded<value_t,count_t>&) = delete;
+        tallyman_map_sharded<value_t,count_t>& operator=(const tallyman_map_sharded<value_t,count_t>&) = delete;
+
+        using tallyman<value_t,count_t>::tally;
+        virtual void tally(const value_t *begin, const value_t *end);
+        virtual void add_invalid(count_t n);
+
+        virtual bool is_map() const { return true; }
+        virtual bool is_concurrent() const { return true; }
+
+        virtual const count_t *get_results_vec() const;
+        virtual const std::map<value_t,count_t>& get_results_map() const;
+
+        virtual unsigned map_shards() const { return 1U << shard_bits_; }
+        virtual const std::map<value_t,count_t>& get_results_shard(unsigned n) const { return shards_[n].map; }
+
+        unsigned shard_of(value_t i) const { return shard_shift_ < bitsize<value_t> ? i >> shard_shift_ : 0; }
+};
+
+// tallyman_hash - tallyman that keeps its counts in a hash table
+//
+// The table is a flat array of (value, count) entries, which is probed
+// linearly from the slot that a multiplicative hash of the value gives.
+// An entry holding the all ones value is empty, so the count of that value
+// (possible only when nbits is the bit size of value_t) is kept aside.  The
+// table doubles when it is more than max_load full, so it holds between
+// 0.35 and 0.7 entries per slot, and unlike std::map has no per-entry
+// overhead or chain of pointers to follow for each lookup.
+//
+// As the order of the entries in the table is arbitrary, finish() moves the
+// used entries to the front and sorts them on value.  Only then can the
+// results be obtained, with get_results_hash().  After finish() no more
+// items can be tallied.  The static table_bytes(n) gives the memory the
+// table takes, at its peak while growing, to hold n distinct values.
+//
+template<typename value_t, typename count_t>
+class tallyman_hash : public tallyman<value_t,count_t>
+{
+    static_assert(std::is_unsigned<value_t>::value,
+            "template argument value_t must be unsigned integral");
+    static_assert(std::is_integral<count_t>::value || std::is_floating_point<count_t>::value,
+            "template argument count_t must be a numerical type");
+
+    public:
+        typedef typename tallyman<value_t,count_t>::entry entry;
+
+    private:
+        constexpr static value_t empty = ~static_cast<value_t>(0);
+        constexpr static unsigned min_bits = 10;
+        constexpr static double max_load = 0.7;
+
+        entry *table_;
+        unsigned bits_;
+        size_t size_;
+        size_t grow_at_;
+        count_t empty_count_;
+        bool finished_;
+
+        static entry *alloc_table(unsigned bits);
+        size_t slot_of(value_t i) const { return (static_cast<std::uint64_t>(i) * 0x9E3779B97F4A7C15ULL) >> (64 - bits_); }
+        void tally_one(value_t i);
+        void grow();
+
+    public:
+        tallyman_hash<value_t,count_t>(int nbits, size_t n_expect = 0);
+        tallyman_hash<value_t,count_t>(const tallyman_hash<value_t,count_t>&) = delete;
+        tallyman_hash<value_t,count_t>& operator=(const tallyman_hash<value_t,count_t>&) = delete;
+        virtual ~tallyman_hash<value_t,count_t>();
+
+        using tallyman<value_t,count_t>::tally;
+        virtual void tally(const value_t *begin, const value_t *end);
+
+        virtual bool is_hash() const { return true; }
+
+        virtual void finish();
+
+        virtual const count_t *get_results_vec() const;
+        virtual const std::map<value_t,count_t>& get_results_map() const;
+        virtual const entry *get_results_hash(size_t& n) const;
+
+        size_t size() const { return size_ + (empty_count_ ? 1 : 0); }
+
+        static size_t table_bytes(size_t n);
+};
+
+// tallyman_vec_compact - vector tallyman with small cells and an overflow
+//
+// Keeps a vector like tallyman_vec, but of cell_t (8 or 16-bit) cells, which
+// takes a quarter (or half) of the memory of a vector of 32-bit counts, and
+// has more of it in cache.  A cell counts up to its maximum, after which any
+// further tallies of its value go to a tallyman_hash, so that the true count
+// is the cell maximum plus the overflow count.  As most cells never saturate,
+// the overflow holds few values, and these are tallied without a map lookup.
+//
+// The get_results_range() member merges the cells and the overflow into a
+// range of counts.  As the overflow is a tallyman_hash, it must be finished
+// before the results are read, and no items can be tallied after finish().
+//
+template <typename value_t, typename count_t, typename cell_t = std::uint8_t>
+class tallyman_vec_compact : public tallyman<value_t,count_t>
+{
+    static_assert(std::is_unsigned<cell_t>::value,
+            "template argument cell_t must be unsigned integral");
+
+    public:
+        typedef typename tallyman<value_t,count_t>::entry entry;
+
+    private:
+        constexpr static cell_t cell_max = ~static_cast<cell_t>(0);
+
+        cell_t *cells_;
+        tallyman_hash<value_t,count_t> overflow_;
+
+    public:
+        tallyman_vec_compact<value_t,count_t,cell_t>(int nbits);
+        tallyman_vec_compact<value_t,count_t,cell_t>(const tallyman_vec_compact&) = delete;
+        tallyman_vec_compact<value_t,count_t,cell_t>& operator=(const tallyman_vec_compact&) = delete;
+        virtual ~tallyman_vec_compact<value_t,count_t,cell_t>();
+
+        using tallyman<value_t,count_t>::tally;
+        virtual void tally(const value_t *begin, const value_t *end);
+
+        struct sink_t {
+            cell_t *cells;
+            tallyman_hash<value_t,count_t> *overflow;
+            void operator()(value_t i) const {
+                if (cells[i] != cell_max)
+                    ++cells[i];
+                else
+                    overflow->tally(&i, &i + 1);
+            }
+            void prefetch(value_t i) const { __builtin_prefetch(cells + i, 1); }
+        };
+
+        sink_t sink() { return sink_t { cells_, &overflow_ }; }
+
+        bool prefetches() const {
+            return tally_prefetch_distance &&
+                (static_cast<size_t>(tallyman<value_t,count_t>::max_value_) + 1) * sizeof(cell_t) >= tally_prefetch_bytes;
+        }
+
+        virtual bool is_compact() const { return true; }
+
+        virtual void finish() { overflow_.finish(); }
+
+        virtual const count_t *get_results_vec() const;
+        virtual const std::map<value_t,count_t>& get_results_map() const;
+        virtual void get_results_range(size_t lo, size_t n, count_t *out) const;
+
+        size_t overflow_size() const { return overflow_.size(); }
+};
+
+// tallyman_bits - vector tallyman with cells of one or two bits
+//
+// Packs the cells of cell_bits bits in 64-bit words.  With one bit per cell,
+// it records the presence of each value, and its count is 0 or 1.  With two
+// bits, it counts up to 3, which then stands for 3 or more.  This serves the
+// jobs that only need to know which values occur, or which occur just once,
+// and takes a 32nd or 16th of the memory of a vector of 32-bit counts.
+// Like tallyman_vec it is not concurrent: on several threads the counting
+// engine tallies it a block at a time under a lock (see countengine.h).
+//
+template <typename value_t, typename count_t, unsigned cell_bits>
+class tallyman_bits : public tallyman<value_t,count_t>
+{
+    static_assert(cell_bits == 1 || cell_bits == 2,
+            "template argument cell_bits must be 1 or 2");
+
+    private:
+        constexpr static unsigned word_cells = 64 / cell_bits;
+        constexpr static std::uint64_t cell_max = (1U << cell_bits) - 1;
+
+        std::uint64_t *words_;
+
+        size_t alloc_size() const;
+
+    public:
+        tallyman_bits<value_t,count_t,cell_bits>(int nbits);
+        tallyman_bits<value_t,count_t,cell_bits>(const tallyman_bits&) = delete;
+        tallyman_bits<value_t,count_t,cell_bits>& operator=(const tallyman_bits&) = delete;
+        virtual ~tallyman_bits<value_t,count_t,cell_bits>();
+
+        using tallyman<value_t,count_t>::tally;
+        virtual void tally(const value_t *begin, const value_t *end);
+
+        struct sink_t {
+            std::uint64_t *words;
+            void operator()(value_t i) const {
+                std::uint64_t& w = words[i / word_cells];
+                unsigned s = (i % word_cells) * cell_bits;
+                if (cell_bits == 1)
+                    w |= std::uint64_t(1) << s;
+                else
+                    w += static_cast<std::uint64_t>(((w >> s) & cell_max) != cell_max) << s;
+            }
+            void prefetch(value_t i) const { __builtin_prefetch(words + i / word_cells, 1); }
+        };
+
+        sink_t sink() { return sink_t { words_ }; }
+
+        bool prefetches() const { return tally_prefetch_distance && alloc_size() >= tally_prefetch_bytes; }
+
+        virtual bool is_compact() const { return true; }
+        virtual count_t count_cap() const { return cell_max; }
+
+        virtual const count_t *get_results_vec() const;
+        virtual const std::map<value_t,count_t>& get_results_map() const;
+        virtual void get_results_range(size_t lo, size_t n, count_t *out) const;
+};
+
 // constructors --------------------------------------------------------------
 
 template<typename value_t, typename count_t>
 tallyman<value_t,count_t>::tallyman(int nbits)
-    : max_value_((static_cast<value_t>(1)<<nbits)-1), n_invalid_(0)
+    : max_value_(nbits < static_cast<int>(bitsize<value_t>) ? (static_cast<value_t>(1)<<nbits)-1 : ~static_cast<value_t>(0)), n_invalid_(0)
 {
     constexpr int max_bits = 8*sizeof(value_t);
     if (nbits < 1)
@@ -161,23 +643,127 @@ tallyman_vec<value_t,count_t>::tallyman_vec(int nbits)
     size_t alloc_n = tallyman<value_t,count_t>::max_value_ + 1;
     size_t alloc_size = alloc_n * sizeof(count_t);
 
-    vec_ = (count_t*) std::calloc(alloc_n, sizeof(count_t));
+    vec_ = (count_t*) interleaved_calloc(alloc_size);
     if (!vec_)
         raise_error("failed to allocate memory (%luMB) for tally vector",
                 static_cast<unsigned long>(alloc_size >> 20));
 }
 
+template<typename value_t, typename count_t>
+tallyman_vec<value_t,count_t>::~tallyman_vec()
+{
+    if (vec_)
+        interleaved_free(vec_, (static_cast<size_t>(tallyman<value_t,count_t>::max_value_) + 1) * sizeof(count_t));
+}
+
+template<typename value_t, typename count_t>
+tallyman_vec_atomic<value_t,count_t>::tallyman_vec_atomic(int nbits)
+    : tallyman_vec<value_t,count_t>(nbits)
+{
+}
+
+template<typename value_t, typename count_t>
+tallyman_vec_private<value_t,count_t>::tallyman_vec_private(int nbits, unsigned n_threads)
+    : tallyman_vec<value_t,count_t>(nbits),
+      n_threads_(n_threads ? n_threads : 1), finished_(false)
+{
+    static std::atomic<unsigned long> next_serial(0);
+    serial_ = ++next_serial;
+}
+
+template<typename value_t, typename count_t>
+tallyman_vec_blocked<value_t,count_t>::tallyman_vec_blocked(int nbits)
+    : tallyman_vec<value_t,count_t>(nbits), part_bits_(0)
+{
+    // the number of regions of region_bytes, capped at 2^max_part_bits
+
+    size_t region_n = region_bytes / sizeof(count_t);
+    while (part_bits_ < max_part_bits && (static_cast<size_t>(tallyman<value_t,count_t>::max_value_) >> part_bits_) >= region_n)
+        ++part_bits_;
+
+    shift_ = nbits - part_bits_;
+
+    size_t n_parts = 1UL << part_bits_;
+    buf_.reset(new value_t[n_parts * bucket_len]);
+    fill_.reset(new value_t*[n_parts]);
+
+    for (size_t b = 0; b != n_parts; ++b)
+        fill_[b] = buf_.get() + b * bucket_len;
+}
+
 template<typename value_t, typename count_t>
 tallyman_map<value_t,count_t>::tallyman_map(int nbits)
     : tallyman<value_t,count_t>(nbits)
 {
 }
 
+template<typename value_t, typename count_t>
+tallyman_map_sharded<value_t,count_t>::tallyman_map_sharded(int nbits, unsigned shard_bits)
+    : tallyman<value_t,count_t>(nbits),
+      shard_bits_(shard_bits < static_cast<unsigned>(nbits) ? shard_bits : nbits),
+      shard_shift_(nbits - shard_bits_),
+      shards_(new shard[1U << shard_bits_])
+{
+    if (shard_bits > 16)
+        raise_error("number of shard bits (%u) exceeds maximum 16", shard_bits);
+}
+
+template<typename value_t, typename count_t>
+tallyman_hash<value_t,count_t>::tallyman_hash(int nbits, size_t n_expect)
+    : tallyman<value_t,count_t>(nbits),
+      table_(0), bits_(min_bits), size_(0), empty_count_(0), finished_(false)
+{
+    while (bits_ < 63 && n_expect > (1UL << bits_) * max_load)
+        ++bits_;
+
+    table_ = alloc_table(bits_);
+    grow_at_ = (1UL << bits_) * max_load;
+}
+
+template<typename value_t, typename count_t, typename cell_t>
+tallyman_vec_compact<value_t,count_t,cell_t>::tallyman_vec_compact(int nbits)
+    : tallyman<value_t,count_t>(nbits), cells_(0), overflow_(nbits)
+{
+    size_t alloc_size = (static_cast<size_t>(tallyman<value_t,count_t>::max_value_) + 1) * sizeof(cell_t);
+
+    cells_ = (cell_t*) interleaved_calloc(alloc_size);
+    if (!cells_)
+        raise_error("failed to allocate memory (%luMB) for compact tally vector",
+                static_cast<unsigned long>(alloc_size >> 20));
+}
+
+template<typename value_t, typename count_t, unsigned cell_bits>
+tallyman_bits<value_t,count_t,cell_bits>::tallyman_bits(int nbits)
+    : tallyman<value_t,count_t>(nbits), words_(0)
+{
+    words_ = (std::uint64_t*) interleaved_calloc(alloc_size());
+    if (!words_)
+        raise_error("failed to allocate memory (%luMB) for tally bit vector",
+                static_cast<unsigned long>(alloc_size() >> 20));
+}
+
+// tallyman ------------------------------------------------------------------
+
+template<typename value_t, typename count_t>
+const typename tallyman<value_t,count_t>::entry*
+tallyman<value_t,count_t>::get_results_hash(size_t&) const
+{
+    raise_error("invalid invocation: get_results_hash on non-hash implementation");
+    return 0;
+}
+
+template<typename value_t, typename count_t>
+void
+tallyman<value_t,count_t>::get_results_range(size_t, size_t, count_t*) const
+{
+    raise_error("invalid invocation: get_results_range on non-compact implementation");
+}
+
 // tallyman_vec --------------------------------------------------------------
 
 template<typename value_t, typename count_t>
 inline void
-tallyman_vec<value_t,count_t>::tally(value_t i)
+tallyman_vec<value_t,count_t>::tally_one(value_t i)
 {
     if (i > tallyman<value_t,count_t>::max_value_)
         ++tallyman<value_t,count_t>::n_invalid_;
@@ -186,19 +772,11 @@ tallyman_vec<value_t,count_t>::tally(value_t i)
 }
 
 template<typename value_t, typename count_t>
-inline void
-tallyman_vec<value_t,count_t>::tally(std::vector<value_t> &&ii)
+void
+tallyman_vec<value_t,count_t>::tally(const value_t *begin, const value_t *end)
 {
-    for (auto i : ii)
-        tally(i);
-}
-
-template<typename value_t, typename count_t>
-inline void
-tallyman_vec<value_t,count_t>::tally(const std::vector<value_t>& ii)
-{
-    for (auto i : ii)
-        tally(i);
+    for (const value_t *p = begin; p != end; ++p)
+        tally_one(*p);
 }
 
 template<typename value_t, typename count_t>
@@ -210,11 +788,187 @@ tallyman_vec<value_t,count_t>::get_results_map() const
     return dummy;
 }
 
+// tallyman_vec_atomic -------------------------------------------------------
+
+template<typename value_t, typename count_t>
+void
+tallyman_vec_atomic<value_t,count_t>::tally(const value_t *begin, const value_t *end)
+{
+    const value_t max_value = tallyman<value_t,count_t>::max_value_;
+    count_t *vec = tallyman_vec<value_t,count_t>::vec_;
+    count_t n_invalid = 0;
+
+    for (const value_t *p = begin; p != end; ++p)
+        if (*p > max_value)
+            ++n_invalid;
+        else
+            __atomic_fetch_add(vec + *p, 1, __ATOMIC_RELAXED);
+
+    if (n_invalid)
+        __atomic_fetch_add(&(tallyman<value_t,count_t>::n_invalid_), n_invalid, __ATOMIC_RELAXED);
+}
+
+// tallyman_vec_private ------------------------------------------------------
+
+template<typename value_t, typename count_t>
+tallyman_vec_private<value_t,count_t>::~tallyman_vec_private()
+{
+    for (size_t n = 1; n < slots_.size(); ++n)
+        if (slots_[n].vec)
+            free(slots_[n].vec);
+}
+
+template<typename value_t, typename count_t>
+typename tallyman_vec_private<value_t,count_t>::slot&
+tallyman_vec_private<value_t,count_t>::my_slot()
+{
+    // each thread caches the slot it last used, keyed on the instance serial
+
+    thread_local unsigned long cached_serial = 0;
+    thread_local slot *cached_slot = 0;
+
+    if (cached_serial == serial_)
+        return *cached_slot;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (finished_)
+        raise_error("programmer error: tally on finished tallyman");
+
+    slot *&owned = owners_[std::this_thread::get_id()];
+
+    if (!owned) {
+        count_t *vec = tallyman_vec<value_t,count_t>::vec_;
+
+        if (!slots_.empty()) {
+            size_t alloc_n = tallyman<value_t,count_t>::max_value_ + 1;
+            vec = (count_t*) std::calloc(alloc_n, sizeof(count_t));
+            if (!vec)
+                raise_error("failed to allocate memory (%luMB) for private tally vector",
+                        static_cast<unsigned long>((alloc_n * sizeof(count_t)) >> 20));
+        }
+
+        slots_.push_back(slot { vec, 0 });
+        owned = &slots_.back();
+    }
+
+    cached_serial = serial_;
+    cached_slot = owned;
+
+    return *owned;
+}
+
+template<typename value_t, typename count_t>
+void
+tallyman_vec_private<value_t,count_t>::tally(const value_t *begin, const value_t *end)
+{
+    const value_t max_value = tallyman<value_t,count_t>::max_value_;
+    slot& s = my_slot();
+    count_t *vec = s.vec;
+    count_t n_invalid = 0;
+
+    for (const value_t *p = begin; p != end; ++p)
+        if (*p > max_value)
+            ++n_invalid;
+        else
+            ++vec[*p];
+
+    s.n_invalid += n_invalid;
+}
+
+template<typename value_t, typename count_t>
+void
+tallyman_vec_private<value_t,count_t>::add_vec(count_t *__restrict dst, const count_t *__restrict src, size_t n)
+{
+    for (size_t i = 0; i != n; ++i)
+        dst[i] += src[i];
+}
+
+template<typename value_t, typename count_t>
+void
+tallyman_vec_private<value_t,count_t>::finish()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (finished_)
+        return;
+
+    finished_ = true;
+
+    for (auto& s : slots_)
+        tallyman<value_t,count_t>::n_invalid_ += s.n_invalid;
+
+    if (slots_.size() < 2)
+        return;
+
+    // each thread adds a range of every private vector into the shared one
+
+    count_t *sum = tallyman_vec<value_t,count_t>::vec_;
+    size_t n = static_cast<size_t>(tallyman<value_t,count_t>::max_value_) + 1;
+    unsigned nt = n < (1UL << 16) ? 1 : n_threads_;
+
+    auto reduce = [this, sum, n, nt](unsigned t) {
+        size_t lo = n * t / nt, hi = n * (t+1) / nt;
+        for (size_t i = 1; i < slots_.size(); ++i)
+            add_vec(sum + lo, slots_[i].vec + lo, hi - lo);
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < nt; ++t)
+        threads.emplace_back(reduce, t);
+
+    reduce(0);
+
+    for (auto& t : threads)
+        t.join();
+
+    for (size_t i = 1; i < slots_.size(); ++i) {
+        free(slots_[i].vec);
+        slots_[i].vec = 0;
+    }
+}
+
+// tallyman_vec_blocked ------------------------------------------------------
+
+template<typename value_t, typename count_t>
+void
+tallyman_vec_blocked<value_t,count_t>::flush(size_t b)
+{
+    count_t *vec = tallyman_vec<value_t,count_t>::vec_;
+    value_t *begin = buf_.get() + b * bucket_len;
+
+    for (const value_t *p = begin; p != fill_[b]; ++p)
+        ++vec[*p];
+
+    fill_[b] = begin;
+}
+
+template<typename value_t, typename count_t>
+void
+tallyman_vec_blocked<value_t,count_t>::tally(const value_t *begin, const value_t *end)
+{
+    const value_t max_value = tallyman<value_t,count_t>::max_value_;
+
+    for (const value_t *p = begin; p != end; ++p)
+        if (*p > max_value)
+            ++tallyman<value_t,count_t>::n_invalid_;
+        else
+            put(*p);
+}
+
+template<typename value_t, typename count_t>
+void
+tallyman_vec_blocked<value_t,count_t>::finish()
+{
+    for (size_t b = 0; b != (1UL << part_bits_); ++b)
+        flush(b);
+}
+
 // tallyman_map --------------------------------------------------------------
 
 template<typename value_t, typename count_t>
 inline void
-tallyman_map<value_t,count_t>::tally(value_t i)
+tallyman_map<value_t,count_t>::tally_one(value_t i)
 {
     if (i > tallyman<value_t,count_t>::max_value_)
         ++tallyman<value_t,count_t>::n_invalid_;
@@ -228,29 +982,372 @@ tallyman_map<value_t,count_t>::tally(value_t i)
 }
 
 template<typename value_t, typename count_t>
-inline void
-tallyman_map<value_t,count_t>::tally(std::vector<value_t> &&ii)
+void
+tallyman_map<value_t,count_t>::tally(const value_t *begin, const value_t *end)
 {
-    for (auto i : ii)
-        tally(i);
+    for (const value_t *p = begin; p != end; ++p)
+        tally_one(*p);
 }
 
 template<typename value_t, typename count_t>
-inline void
-tallyman_map<value_t,count_t>::tally(const std::vector<value_t>& ii)
+const count_t*
+tallyman_map<value_t,count_t>::get_results_vec() const
 {
-    for (auto i : ii)
-        tally(i);
+    raise_error("invalid invocation: get_results_vec on map implementation");
+    return 0;
+}
+
+// tallyman_map_sharded ------------------------------------------------------
+
+template<typename value_t, typename count_t>
+void
+tallyman_map_sharded<value_t,count_t>::tally(const value_t *begin, const value_t *end)
+{
+    // per-thread scratch space for grouping the items by shard
+    thread_local std::vector<size_t> offsets;
+    thread_local std::vector<value_t> grouped;
+
+    const unsigned n_shards = 1U << shard_bits_;
+    const value_t max_value = tallyman<value_t,count_t>::max_value_;
+    count_t n_invalid = 0;
+
+    offsets.assign(n_shards + 1, 0);
+    grouped.resize(end - begin);
+
+    // count the items per shard, then turn counts into start offsets
+
+    for (const value_t *p = begin; p != end; ++p)
+        if (*p > max_value)
+            ++n_invalid;
+        else
+            ++offsets[shard_of(*p) + 1];
+
+    for (unsigned n = 1; n <= n_shards; ++n)
+        offsets[n] += offsets[n-1];
+
+    // scatter the valid items to their groups, which moves each offset
+    // to the start of the next group
+
+    for (const value_t *p = begin; p != end; ++p)
+        if (*p <= max_value)
+            grouped[offsets[shard_of(*p)]++] = *p;
+
+    // tally each group while holding its shard's lock
+
+    size_t lo = 0;
+    for (unsigned n = 0; n != n_shards; ++n) {
+        size_t hi = offsets[n];
+
+        if (lo != hi) {
+            std::map<value_t,count_t>& map = shards_[n].map;
+            std::lock_guard<std::mutex> lock(shards_[n].mutex);
+
+            for (size_t j = lo; j != hi; ++j) {
+                value_t i = grouped[j];
+                iterator p = map.lower_bound(i);
+                if (p == map.end() || i != p->first)
+                    map.insert(p, std::make_pair(i,1));
+                else
+                    ++(p->second);
+            }
+        }
+
+        lo = hi;
+    }
+
+    if (n_invalid)
+        add_invalid(n_invalid);
+}
+
+template<typename value_t, typename count_t>
+void
+tallyman_map_sharded<value_t,count_t>::add_invalid(count_t n)
+{
+    std::lock_guard<std::mutex> lock(invalid_mutex_);
+    tallyman<value_t,count_t>::n_invalid_ += n;
 }
 
 template<typename value_t, typename count_t>
 const count_t*
-tallyman_map<value_t,count_t>::get_results_vec() const
+tallyman_map_sharded<value_t,count_t>::get_results_vec() const
 {
     raise_error("invalid invocation: get_results_vec on map implementation");
     return 0;
 }
 
+template<typename value_t, typename count_t>
+const std::map<value_t,count_t>&
+tallyman_map_sharded<value_t,count_t>::get_results_map() const
+{
+    if (shard_bits_ != 0)
+        raise_error("invalid invocation: get_results_map on sharded map, use get_results_shard");
+    return shards_[0].map;
+}
+
+
+// tallyman_hash -------------------------------------------------------------
+
+template<typename value_t, typename count_t>
+tallyman_hash<value_t,count_t>::~tallyman_hash()
+{
+    free(table_);
+}
+
+template<typename value_t, typename count_t>
+typename tallyman_hash<value_t,count_t>::entry*
+tallyman_hash<value_t,count_t>::alloc_table(unsigned bits)
+{
+    size_t n = 1UL << bits;
+    entry *t = (entry*) std::malloc(n * sizeof(entry));
+
+    if (!t)
+        raise_error("failed to allocate memory (%luMB) for hash table",
+                static_cast<unsigned long>((n * sizeof(entry)) >> 20));
+
+    for (size_t i = 0; i != n; ++i)
+        t[i] = entry { empty, 0 };
+
+    return t;
+}
+
+template<typename value_t, typename count_t>
+size_t
+tallyman_hash<value_t,count_t>::table_bytes(size_t n)
+{
+    unsigned bits = min_bits;
+    while (bits < 63 && n > (1UL << bits) * max_load)
+        ++bits;
+
+    // while growing to 2^bits slots, the table of half that size is live too
+
+    return sizeof(entry) * ((1UL << bits) + (1UL << (bits - 1)));
+}
+
+template<typename value_t, typename count_t>
+void
+tallyman_hash<value_t,count_t>::grow()
+{
+    entry *old = table_;
+    size_t old_n = 1UL << bits_;
+
+    table_ = alloc_table(++bits_);
+    grow_at_ = (1UL << bits_) * max_load;
+
+    const size_t mask = (1UL << bits_) - 1;
+
+    for (const entry *p = old; p != old + old_n; ++p)
+        if (p->value != empty) {
+            size_t j = slot_of(p->value);
+            while (table_[j].value != empty)
+                j = (j + 1) & mask;
+            table_[j] = *p;
+        }
+
+    free(old);
+}
+
+template<typename value_t, typename count_t>
+inline void
+tallyman_hash<value_t,count_t>::tally_one(value_t i)
+{
+    if (i > tallyman<value_t,count_t>::max_value_)
+        ++tallyman<value_t,count_t>::n_invalid_;
+    else if (i == empty)
+        ++empty_count_;
+    else {
+        const size_t mask = (1UL << bits_) - 1;
+        size_t j = slot_of(i);
+
+        while (table_[j].value != i && table_[j].value != empty)
+            j = (j + 1) & mask;
+
+        if (table_[j].value == i)
+            ++table_[j].count;
+        else {
+            table_[j] = entry { i, 1 };
+            if (++size_ > grow_at_)
+                grow();
+        }
+    }
+}
+
+template<typename value_t, typename count_t>
+void
+tallyman_hash<value_t,count_t>::tally(const value_t *begin, const value_t *end)
+{
+    if (finished_)
+        raise_error("programmer error: tally on finished tallyman");
+
+    for (const value_t *p = begin; p != end; ++p)
+        tally_one(*p);
+}
+
+template<typename value_t, typename count_t>
+void
+tallyman_hash<value_t,count_t>::finish()
+{
+    if (finished_)
+        return;
+
+    finished_ = true;
+
+    // move the used entries to the front, and sort them
+
+    entry *q = table_;
+    for (entry *p = table_; p != table_ + (1UL << bits_); ++p)
+        if (p->value != empty)
+            *q++ = *p;
+
+    std::sort(table_, q, [](const entry& a, const entry& b) { return a.value < b.value; });
+
+    // the empty value sorts last, so can take the slot after them
+
+    if (empty_count_)
+        *q = entry { empty, empty_count_ };
+}
+
+template<typename value_t, typename count_t>
+const typename tallyman_hash<value_t,count_t>::entry*
+tallyman_hash<value_t,count_t>::get_results_hash(size_t& n) const
+{
+    if (!finished_)
+        raise_error("programmer error: get_results_hash before finish");
+
+    n = size();
+    return table_;
+}
+
+template<typename value_t, typename count_t>
+const count_t*
+tallyman_hash<value_t,count_t>::get_results_vec() const
+{
+    raise_error("invalid invocation: get_results_vec on hash implementation");
+    return 0;
+}
+
+template<typename value_t, typename count_t>
+const std::map<value_t,count_t>&
+tallyman_hash<value_t,count_t>::get_results_map() const
+{
+    static std::map<value_t,count_t> dummy;
+    raise_error("invalid invocation: get_results_map on hash implementation");
+    return dummy;
+}
+
+
+// tallyman_vec_compact ------------------------------------------------------
+
+template<typename value_t, typename count_t, typename cell_t>
+tallyman_vec_compact<value_t,count_t,cell_t>::~tallyman_vec_compact()
+{
+    if (cells_)
+        interleaved_free(cells_, (static_cast<size_t>(tallyman<value_t,count_t>::max_value_) + 1) * sizeof(cell_t));
+}
+
+template<typename value_t, typename count_t, typename cell_t>
+void
+tallyman_vec_compact<value_t,count_t,cell_t>::tally(const value_t *begin, const value_t *end)
+{
+    const value_t max_value = tallyman<value_t,count_t>::max_value_;
+    sink_t sink = this->sink();
+
+    for (const value_t *p = begin; p != end; ++p)
+        if (*p > max_value)
+            ++tallyman<value_t,count_t>::n_invalid_;
+        else
+            sink(*p);
+}
+
+template<typename value_t, typename count_t, typename cell_t>
+void
+tallyman_vec_compact<value_t,count_t,cell_t>::get_results_range(size_t lo, size_t n, count_t *out) const
+{
+    for (size_t i = 0; i != n; ++i)
+        out[i] = cells_[lo + i];
+
+    // the overflow entries are sorted, so those in range are consecutive
+
+    size_t n_over = 0;
+    const entry *pbeg = overflow_.get_results_hash(n_over);
+    const entry *p = std::lower_bound(pbeg, pbeg + n_over, lo,
+            [](const entry& e, size_t v) { return e.value < v; });
+
+    for (; p != pbeg + n_over && p->value - lo < n; ++p)
+        out[p->value - lo] += p->count;
+}
+
+template<typename value_t, typename count_t, typename cell_t>
+const count_t*
+tallyman_vec_compact<value_t,count_t,cell_t>::get_results_vec() const
+{
+    raise_error("invalid invocation: get_results_vec on compact implementation");
+    return 0;
+}
+
+template<typename value_t, typename count_t, typename cell_t>
+const std::map<value_t,count_t>&
+tallyman_vec_compact<value_t,count_t,cell_t>::get_results_map() const
+{
+    static std::map<value_t,count_t> dummy;
+    raise_error("invalid invocation: get_results_map on compact implementation");
+    return dummy;
+}
+
+// tallyman_bits -------------------------------------------------------------
+
+template<typename value_t, typename count_t, unsigned cell_bits>
+tallyman_bits<value_t,count_t,cell_bits>::~tallyman_bits()
+{
+    if (words_)
+        interleaved_free(words_, alloc_size());
+}
+
+template<typename value_t, typename count_t, unsigned cell_bits>
+size_t
+tallyman_bits<value_t,count_t,cell_bits>::alloc_size() const
+{
+    size_t n_cells = static_cast<size_t>(tallyman<value_t,count_t>::max_value_) + 1;
+    return ((n_cells + word_cells - 1) / word_cells) * sizeof(std::uint64_t);
+}
+
+template<typename value_t, typename count_t, unsigned cell_bits>
+void
+tallyman_bits<value_t,count_t,cell_bits>::tally(const value_t *begin, const value_t *end)
+{
+    const value_t max_value = tallyman<value_t,count_t>::max_value_;
+    sink_t sink = this->sink();
+
+    for (const value_t *p = begin; p != end; ++p)
+        if (*p > max_value)
+            ++tallyman<value_t,count_t>::n_invalid_;
+        else
+            sink(*p);
+}
+
+template<typename value_t, typename count_t, unsigned cell_bits>
+void
+tallyman_bits<value_t,count_t,cell_bits>::get_results_range(size_t lo, size_t n, count_t *out) const
+{
+    for (size_t i = lo; i != lo + n; ++i)
+        *out++ = (words_[i / word_cells] >> ((i % word_cells) * cell_bits)) & cell_max;
+}
+
+template<typename value_t, typename count_t, unsigned cell_bits>
+const count_t*
+tallyman_bits<value_t,count_t,cell_bits>::get_results_vec() const
+{
+    raise_error("invalid invocation: get_results_vec on bit vector implementation");
+    return 0;
+}
+
+template<typename value_t, typename count_t, unsigned cell_bits>
+const std::map<value_t,count_t>&
+tallyman_bits<value_t,count_t,cell_bits>::get_results_map() const
+{
+    static std::map<value_t,count_t> dummy;
+    raise_error("invalid invocation: get_results_map on bit vector implementation");
+    return dummy;
+}
 
 } // namespace kfc
 
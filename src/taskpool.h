@@ -0,0 +1,286 @@
+/* taskpool.h
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef taskpool_h_INCLUDED
+#define taskpool_h_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "numautils.h"
+#include "utils.h"
+
+namespace kfc {
+
+
+// task_pool - work-stealing pool of worker threads
+//
+// The pool starts n_threads workers that each call run(task) on the tasks
+// submitted to the pool.  Every worker has its own deque of tasks.  submit()
+// deals the tasks round robin over the deques; a worker takes tasks from the
+// back of its own deque, and when that is empty it steals from the front of
+// the other workers' deques.  This way no worker sits idle while another
+// still has a backlog, whatever the mix of large and small tasks.
+//
+// When capacity tasks are pending, submit() blocks until a worker has taken
+// one; this keeps a fast producer (the reader) from running arbitrarily far
+// ahead of the workers.
+//
+// Call finish() when all tasks have been submitted.  It waits until the
+// workers have run all pending tasks and terminated.  The destructor calls
+// finish() if it was not called.  Submitting after finish() is a programmer
+// error.
+//
+// On a machine with more than one NUMA node, the workers are spread round
+// robin over the nodes, and each is bound to the CPUs of its node.  With
+// verbose output on, the constructor reports this layout.
+//
+// The pool keeps per worker statistics: the number of tasks run, how many
+// of these were stolen, and the fraction of its lifetime the worker spent
+// running tasks.  With verbose output on, finish() reports these.
+//
+template <typename T>
+class task_pool {
+
+    public:
+        typedef std::function<void(T&)> run_fn;
+
+        struct worker_stats {
+            size_t n_tasks;
+            size_t n_stolen;
+            double busy;    // fraction of wall time spent in run()
+        };
+
+    private:
+        struct worker {
+            std::mutex mutex;
+            std::deque<T> tasks;
+            worker_stats stats;
+        };
+
+        run_fn run_;
+        size_t capacity_;
+        std::unique_ptr<worker[]> workers_;
+        std::vector<std::thread> threads_;
+        unsigned n_threads_;
+        unsigned next_;
+
+        std::mutex mutex_;
+        std::condition_variable have_work_;
+        std::condition_variable have_room_;
+        size_t pending_;
+        bool closed_;
+
+    public:
+        task_pool(unsigned n_threads, size_t capacity, run_fn run);
+        task_pool(const task_pool&) = delete;
+        task_pool& operator=(const task_pool&) = delete;
+        ~task_pool();
+
+        unsigned n_threads() const { return n_threads_; }
+
+        void submit(T&& task);
+        void finish();
+
+        const worker_stats& stats(unsigned i) const { return workers_[i].stats; }
+
+    private:
+        bool take(unsigned self, T& task, bool& stolen);
+        void work(unsigned self);
+};
+
+
+// implementation ------------------------------------------------------------
+
+template <typename T>
+task_pool<T>::task_pool(unsigned n_threads, size_t capacity, run_fn run)
+    : run_(run), capacity_(capacity),
+      workers_(new worker[n_threads ? n_threads : 1]),
+      n_threads_(n_threads ? n_threads : 1), next_(0),
+      pending_(0), closed_(false)
+{
+    if (capacity < 1)
+        raise_error("invalid task pool capacity: %lu", capacity);
+
+    unsigned n_nodes = get_numa_nodes();
+
+    if (n_nodes > 1)
+        for (unsigned node = 0; node < n_nodes && node < n_threads_; ++node) {
+            std::string ids;
+            for (unsigned i = node; i < n_threads_; i += n_nodes)
+                ids += (ids.empty() ? "" : ",") + std::to_string(i);
+            verbose_emit("NUMA node %u (cpus %s): threads %s", node,
+                    get_numa_cpus(node).c_str(), ids.c_str());
+        }
+    else
+        verbose_emit("single NUMA node, threads are not bound");
+
+    threads_.reserve(n_threads_);
+    for (unsigned i = 0; i < n_threads_; ++i) {
+        workers_[i].stats = worker_stats { 0, 0, 0.0 };
+        threads_.emplace_back(&task_pool::work, this, i);
+    }
+}
+
+template <typename T>
+task_pool<T>::~task_pool()
+{
+    finish();
+}
+
+template <typename T>
+void
+task_pool<T>::submit(T&& task)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        have_room_.wait(lock, [this] { return pending_ < capacity_ || closed_; });
+
+        if (closed_)
+            raise_error("programmer error: submit on finished task pool");
+
+        // pending_ goes up while holding mutex_, so that a worker that
+        // found no task cannot miss the notification below
+
+        worker& w = workers_[next_];
+        next_ = (next_ + 1) % n_threads_;
+
+        std::lock_guard<std::mutex> wlock(w.mutex);
+        w.tasks.push_back(std::move(task));
+        ++pending_;
+    }
+
+    have_work_.notify_one();
+}
+
+template <typename T>
+bool
+task_pool<T>::take(unsigned self, T& task, bool& stolen)
+{
+    // own tasks first, from the back
+
+    {
+        worker& w = workers_[self];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.tasks.empty()) {
+            task = std::move(w.tasks.back());
+            w.tasks.pop_back();
+            stolen = false;
+            return true;
+        }
+    }
+
+    // then steal from the front of the others, starting at our neighbour
+
+    for (unsigned i = 1; i < n_threads_; ++i) {
+        worker& w = workers_[(self + i) % n_threads_];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.tasks.empty()) {
+            task = std::move(w.tasks.front());
+            w.tasks.pop_front();
+            stolen = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+template <typename T>
+void
+task_pool<T>::work(unsigned self)
+{
+    typedef std::chrono::steady_clock clock;
+
+    unsigned n_nodes = get_numa_nodes();
+
+    if (n_nodes > 1 && !bind_to_node(self % n_nodes))
+        verbose_emit("thread %u: failed to bind to NUMA node %u", self, self % n_nodes);
+
+    worker_stats& stats = workers_[self].stats;
+    clock::time_point t_start = clock::now();
+    clock::duration t_busy = clock::duration::zero();
+
+    T task;
+    bool stolen;
+
+    for (;;) {
+        if (take(self, task, stolen)) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                --pending_;
+            }
+            have_room_.notify_one();
+
+            clock::time_point t0 = clock::now();
+            run_(task);
+            t_busy += clock::now() - t0;
+
+            ++stats.n_tasks;
+            if (stolen)
+                ++stats.n_stolen;
+        }
+        else {
+            std::unique_lock<std::mutex> lock(mutex_);
+            have_work_.wait(lock, [this] { return pending_ || closed_; });
+            if (!pending_)   // so we are closed and drained
+                break;
+        }
+    }
+
+    clock::duration t_total = clock::now() - t_start;
+    stats.busy = t_total.count() ? double(t_busy.count()) / t_total.count() : 1.0;
+}
+
+template <typename T>
+void
+task_pool<T>::finish()
+{
+    if (threads_.empty())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+
+    have_work_.notify_all();
+    have_room_.notify_all();
+
+    for (auto& t : threads_)
+        t.join();
+
+    threads_.clear();
+
+    for (unsigned i = 0; i < n_threads_; ++i)
+        verbose_emit("thread %u: %lu tasks (%lu stolen), %.1f%% busy", i,
+                workers_[i].stats.n_tasks, workers_[i].stats.n_stolen,
+                100.0 * workers_[i].stats.busy);
+}
+
+
+} // namespace kfc
+
+#endif // taskpool_h_INCLUDED
+       // vim: sts=4:sw=4:ai:si:et
@@ -0,0 +1,262 @@
+/* basepack-test.cpp
+ * 
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "basepack.h"
+#include "basecodec.h"
+#include "bitfiddle.h"
+#include "kmercodec.h"
+
+using namespace kfc;
+
+namespace {
+
+const pack_kernel kernels[] = {
+    pack_kernel::scalar, pack_kernel::sse42, pack_kernel::avx2, pack_kernel::avx512bw };
+
+static std::string
+random_dna(size_t n, unsigned pct_invalid)
+{
+    std::string s(n, 'a');
+    for (size_t i = 0; i != n; ++i)
+        s[i] = std::rand() % 100 < int(pct_invalid) ? "nNxX-."[std::rand() % 6] : "acgtACGT"[std::rand() % 8];
+    return s;
+}
+
+// checks that kernel k gives the codes and mask that encode_base says
+
+static void
+check_pack(pack_kernel k, const std::string& s)
+{
+    size_t n = s.size();
+    std::vector<std::uint8_t> codes(n, 0xAA);
+    std::vector<std::uint64_t> mask((n + 63) / 64, ~0UL);
+
+    pack_bases(k, s.data(), n, codes.data(), mask.data());
+
+    for (size_t i = 0; i != n; ++i) {
+        std::uint8_t c = encode_base<std::uint8_t,0xFF>(s[i]);
+        bool bad = (mask[i/64] >> (i%64)) & 1;
+        ASSERT_EQ(bad, c == 0xFF) << pack_kernel_name(k) << " at " << i << " char " << int(s[i]);
+        ASSERT_EQ(codes[i], bad ? 0 : c) << pack_kernel_name(k) << " at " << i;
+    }
+
+    if (n % 64) {
+        ASSERT_EQ(mask[n/64] >> (n%64), 0UL) << pack_kernel_name(k);
+    }
+}
+
+// pack_bases ---------------------------------------------------------
+
+TEST(basepack_test, kernel_names) {
+    EXPECT_STREQ(pack_kernel_name(pack_kernel::scalar), "scalar");
+    EXPECT_STREQ(pack_kernel_name(pack_kernel::sse42), "sse4.2");
+    EXPECT_STREQ(pack_kernel_name(pack_kernel::avx2), "avx2");
+    EXPECT_STREQ(pack_kernel_name(pack_kernel::avx512bw), "avx512bw");
+}
+
+TEST(basepack_test, scalar_always_supported) {
+    EXPECT_TRUE(pack_kernel_supported(pack_kernel::scalar));
+    EXPECT_TRUE(pack_kernel_supported(best_pack_kernel()));
+}
+
+TEST(basepack_test, all_byte_values) {
+    std::string s;
+    for (unsigned i = 0; i != 512; ++i)
+        s.push_back(static_cast<char>(i & 0xFF));
+    for (pack_kernel k : kernels)
+        if (pack_kernel_supported(k))
+            check_pack(k, s);
+}
+
+TEST(basepack_test, odd_lengths) {
+    for (size_t n : { 0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 200, 1000 }) {
+        std::string s = random_dna(n, 5);
+        for (pack_kernel k : kernels)
+            if (pack_kernel_supported(k))
+                check_pack(k, s);
+    }
+}
+
+TEST(basepack_test, default_is_best) {
+    std::string s = random_dna(777, 3);
+    std::vector<std::uint8_t> c1(s.size()), c2(s.size());
+    std::vector<std::uint64_t> m1((s.size()+63)/64), m2((s.size()+63)/64);
+    pack_bases(s.data(), s.size(), c1.data(), m1.data());
+    pack_bases(pack_kernel::scalar, s.data(), s.size(), c2.data(), m2.data());
+    EXPECT_EQ(c1, c2);
+    EXPECT_EQ(m1, m2);
+}
+
+// packed_dna ---------------------------------------------------------
+
+TEST(basepack_test, packed_dna_empty) {
+    packed_dna d;
+    d.assign("", 0);
+    EXPECT_EQ(d.size, 0);
+    EXPECT_TRUE(d.words.empty());
+    EXPECT_TRUE(d.invalid.empty());
+}
+
+TEST(basepack_test, packed_dna_words) {
+    packed_dna d;
+    d.assign("acgtTGCA", 8);
+    ASSERT_EQ(d.words.size(), 1);
+    EXPECT_EQ(d.words[0], 0x1BE4UL);    // a=00 c=01 g=10 t=11 from the low bits
+    EXPECT_TRUE(d.invalid.empty());
+}
+
+TEST(basepack_test, packed_dna_runs) {
+    std::string s(10000, 'a');
+    s.replace(3, 2, "nn");
+    s.replace(60, 10, "nnnnnnnnnn");    // across a mask word
+    s.replace(4090, 12, "xxxxxxxxxxxx");    // across a block
+    s[9999] = '-';
+
+    packed_dna d;
+    d.assign(s.data(), s.size());
+
+    ASSERT_EQ(d.invalid.size(), 4);
+    EXPECT_EQ(d.invalid[0].pos, 3);
+    EXPECT_EQ(d.invalid[0].len, 2);
+    EXPECT_EQ(d.invalid[1].pos, 60);
+    EXPECT_EQ(d.invalid[1].len, 10);
+    EXPECT_EQ(d.invalid[2].pos, 4090);
+    EXPECT_EQ(d.invalid[2].len, 12);
+    EXPECT_EQ(d.invalid[3].pos, 9999);
+    EXPECT_EQ(d.invalid[3].len, 1);
+}
+
+TEST(basepack_test, packed_dna_round_trip) {
+    for (size_t n : { 1, 31, 32, 33, 100, 4096, 5000 }) {
+        std::string s = random_dna(n, 5);
+        std::string e(s);
+        for (auto& c : e)
+            c = encode_base<std::uint8_t,0xFF>(c) == 0xFF ? 'n' : "acgt"[encode_base<std::uint8_t,0xFF>(c)];
+        packed_dna d;
+        d.assign(s.data(), s.size());
+        EXPECT_EQ(d.unpack(), e);
+        if (n % 32) {
+            EXPECT_EQ(d.words.back() >> (2 * (n % 32)), 0UL);
+        }
+    }
+}
+
+TEST(basepack_test, packed_dna_slice) {
+    std::string s = random_dna(1000, 5);
+    packed_dna d;
+    d.assign(s.data(), s.size());
+    std::string u = d.unpack();
+
+    for (size_t pos : { 0, 1, 31, 32, 33, 500, 997, 999, 1000 })
+        for (size_t len : { 0, 1, 2, 32, 63, 200 })
+            if (pos + len <= s.size()) {
+                packed_dna p;
+                p.assign(d, pos, len);
+                EXPECT_EQ(p.unpack(), u.substr(pos, len));
+                for (const auto& r : p.invalid)
+                    EXPECT_GT(r.len, 0UL) << "pos " << pos << " len " << len;
+                if (len % 32) {
+                    EXPECT_EQ(p.words.back() >> (2 * (len % 32)), 0UL);
+                }
+            }
+}
+
+TEST(basepack_test, packed_dna_for_each_valid) {
+    std::string s(200, 'a');
+    s.replace(10, 3, "nnn");
+    s.replace(20, 100, std::string(100, 'n'));
+    s[123] = 'x';
+    s[199] = 'n';
+
+    packed_dna d;
+    d.assign(s.data(), s.size());
+
+    std::vector<size_t> got;
+    auto collect = [&got](size_t lo, size_t hi) { got.push_back(lo); got.push_back(hi); };
+
+    // stretches shorter than k are dropped
+
+    EXPECT_EQ(d.for_each_valid(0, 200, 5, collect), 6 + 3 + 71);
+    EXPECT_EQ(got, std::vector<size_t>({ 0, 10, 13, 20, 124, 199 }));
+
+    // the stretches are clipped to [pos,pos+n)
+
+    got.clear();
+    EXPECT_EQ(d.for_each_valid(5, 118, 3, collect), 3 + 5 + 1);
+    EXPECT_EQ(got, std::vector<size_t>({ 5, 10, 13, 20, 120, 123 }));
+
+    got.clear();
+    EXPECT_EQ(d.for_each_valid(20, 100, 1, collect), 0);
+    EXPECT_TRUE(got.empty());
+}
+
+// packed encoders ----------------------------------------------------
+
+template <typename kmer_t, unsigned ksize>
+static void
+compare_kmers(const std::vector<kmer_t>& exp, const std::vector<kmer_t>& got)
+{
+    for (size_t i = 0; i != exp.size(); ++i) {
+        bool inval = exp[i] & high_bit<kmer_t>;
+        ASSERT_EQ(inval, bool(got[i] & high_bit<kmer_t>)) << "k" << ksize << " at " << i;
+        if (!inval) {
+            ASSERT_EQ(exp[i], got[i]) << "k" << ksize << " at " << i;
+        }
+    }
+}
+
+template <typename kmer_t, unsigned ksize>
+static void
+crosscheck_ss_packed(const std::string& s)
+{
+    size_t n = s.size();
+    std::vector<std::uint8_t> codes(n);
+    std::vector<std::uint64_t> mask((n + 63) / 64);
+    pack_bases(s.data(), n, codes.data(), mask.data());
+
+    std::vector<kmer_t> exp(n - ksize + 1), got(n - ksize + 1);
+    ss_encode<kmer_t,ksize>(s.data(), s.data() + n, exp.data());
+    ss_encode_packed<kmer_t,ksize>(codes.data(), mask.data(), n, got.data());
+    compare_kmers<kmer_t,ksize>(exp, got);
+}
+
+TEST(basepack_test, ss_packed_crosscheck) {
+    for (unsigned pct : { 0, 1, 10, 50 }) {
+        std::string s = random_dna(3000, pct);
+        crosscheck_ss_packed<std::uint32_t,1>(s);
+        crosscheck_ss_packed<std::uint32_t,7>(s);
+        crosscheck_ss_packed<std::uint32_t,15>(s);
+        crosscheck_ss_packed<std::uint64_t,16>(s);
+        crosscheck_ss_packed<std::uint64_t,31>(s);
+    }
+}
+
+TEST(basepack_test, packed_short_input) {
+    std::string s = random_dna(70, 0);
+    s[64] = 'n';
+    crosscheck_ss_packed<std::uint32_t,15>(s.substr(0, 15));
+    crosscheck_ss_packed<std::uint32_t,15>(s);
+}
+
+} // namespace
+
+// vim: sts=4:sw=4:ai:si:et
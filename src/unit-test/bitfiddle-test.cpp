@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstdint>
 #include <gtest/gtest.h>
 #include "bitfiddle.h"
 
@@ -151,6 +152,22 @@ TEST(bitfiddle_test, test_flood_hibit) {
     EXPECT_EQ(flood_hibit(0xA000000000000000L), 0xFFFFFFFFFFFFFFFFL);
 }
 
+TEST(bitfiddle_test, test_byte_swap) {
+    EXPECT_EQ(byte_swap(std::uint8_t(0x12)), 0x12);
+    EXPECT_EQ(byte_swap(std::uint16_t(0x1234)), 0x3412);
+    EXPECT_EQ(byte_swap(0x12345678U), 0x78563412U);
+    EXPECT_EQ(byte_swap(0x0123456789ABCDEFUL), 0xEFCDAB8967452301UL);
+}
+
+TEST(bitfiddle_test, test_reverse_bitpairs) {
+    EXPECT_EQ(reverse_bitpairs(std::uint8_t(0x1B)), 0xE4);
+    EXPECT_EQ(reverse_bitpairs(0x00000001U), 0x40000000U);
+    EXPECT_EQ(reverse_bitpairs(0x0000001BU), 0xE4000000U);
+    EXPECT_EQ(reverse_bitpairs(0xC0000000U), 0x00000003U);
+    EXPECT_EQ(reverse_bitpairs(0x0000000000000002UL), 0x8000000000000000UL);
+    EXPECT_EQ(reverse_bitpairs(0x0123456789ABCDEFUL), 0xFB73EA62D951C840UL);
+}
+
 
 } // namespace
   // vim: sts=4:sw=4:ai:si:et
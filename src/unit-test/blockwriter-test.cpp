@@ -0,0 +1,74 @@
+/* blockwriter-test.cpp
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <gtest/gtest.h>
+#include "blockwriter.h"
+
+using namespace kfc;
+
+namespace {
+
+template <typename T>
+std::string
+num_str(T n) {
+    std::string buf;
+    append_number(buf, n);
+    return buf;
+}
+
+template <typename T>
+std::string
+os_str(T n) {
+    std::ostringstream ss;
+    ss << n;
+    return ss.str();
+}
+
+TEST(blockwriter_test, append_number) {
+    EXPECT_EQ(num_str(0), "0");
+    EXPECT_EQ(num_str(7U), "7");
+    EXPECT_EQ(num_str(-42), "-42");
+    EXPECT_EQ(num_str(std::numeric_limits<std::uint32_t>::max()), os_str(std::numeric_limits<std::uint32_t>::max()));
+    EXPECT_EQ(num_str(std::numeric_limits<std::uint64_t>::max()), os_str(std::numeric_limits<std::uint64_t>::max()));
+    EXPECT_EQ(num_str(std::numeric_limits<std::int64_t>::min()), os_str(std::numeric_limits<std::int64_t>::min()));
+    EXPECT_EQ(num_str(2.5), "2.5");
+}
+
+TEST(blockwriter_test, no_blocks) {
+    std::ostringstream os;
+    write_blocks(os, 0, 4, [](size_t, std::string& buf) { buf.append("x"); });
+    EXPECT_EQ(os.str(), "");
+}
+
+TEST(blockwriter_test, blocks_in_order) {
+    for (unsigned nt : { 1, 3, 4, 16 }) {
+        std::ostringstream os;
+        write_blocks(os, 10, nt, [](size_t b, std::string& buf) {
+            for (size_t i = 0; i <= b; ++i)
+                append_number(buf, b);
+            buf.push_back('\n');
+        });
+        EXPECT_EQ(os.str(), "0\n11\n222\n3333\n44444\n555555\n6666666\n77777777\n888888888\n9999999999\n");
+    }
+}
+
+} // namespace
+  // vim: sts=4:sw=4:ai:si:et
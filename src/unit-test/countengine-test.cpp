@@ -0,0 +1,203 @@
+/* countengine-test.cpp
+ * 
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "countengine.h"
+#include "testutils.h"
+
+using namespace kfc;
+
+namespace {
+
+typedef std::uint32_t u32;
+typedef std::uint64_t u64;
+
+static std::string
+random_dna(size_t n, unsigned seed, unsigned pct_invalid = 2)
+{
+    test_lcg rng(seed);
+    std::string s(n, 'a');
+    for (auto& b : s) {
+        unsigned x = rng();
+        b = (x >> 8) % 100 < pct_invalid ? 'n' : "acgtACGT"[(x >> 16) % 8];
+    }
+    return s;
+}
+
+static std::string
+results(const kmer_counter& c)
+{
+    std::stringstream ss;
+    c.write_results(ss, output_opts::invalids | output_opts::zeros);
+    return ss.str();
+}
+
+// counts seqs with a generic kmer_counter_tally and with the engine
+
+template <typename count_t, typename tman_t>
+static void
+crosscheck(int ks, bool ss, const std::vector<std::string>& seqs, tman_t *etman, tman_t *gtman)
+{
+    std::unique_ptr<kmer_counter> e(make_engine<count_t>(etman, ks, ss, 1));
+    kmer_counter_tally<u32,count_t> g(gtman, ks, ss);
+
+    for (const auto& s : seqs) {
+        e->process(s);
+        g.process(s);
+    }
+
+    EXPECT_EQ(results(*e), results(g)) << "ksize " << ks << (ss ? " ss" : " ds");
+}
+
+// make_engine --------------------------------------------------------
+
+TEST(countengine_test, no_even_ds) {
+    EXPECT_DEATH(make_engine<u32>(new tallyman_vec<u32,u32>(11), 6, false, 1), ".*");
+}
+
+TEST(countengine_test, no_ksize_16) {
+    EXPECT_DEATH(make_engine<u32>(new tallyman_vec<u32,u32>(31), 16, true, 1), ".*");
+}
+
+TEST(countengine_test, vec_crosscheck) {
+    std::vector<std::string> seqs { random_dna(5000, 1), random_dna(150, 2), "ac", "nnnnnnnnnnnnnnnnnn", "acgtnacgt" };
+    for (int ks : { 1, 3, 7, 9 }) {
+        crosscheck<u32>(ks, false, seqs, new tallyman_vec<u32,u32>(2*ks-1), new tallyman_vec<u32,u32>(2*ks-1));
+        crosscheck<u64>(ks, true, seqs, new tallyman_vec<u32,u64>(2*ks), new tallyman_vec<u32,u64>(2*ks));
+    }
+    crosscheck<u32>(8, true, seqs, new tallyman_vec<u32,u32>(16), new tallyman_vec<u32,u32>(16));
+}
+
+TEST(countengine_test, packed_input) {
+    std::string s = random_dna(20000, 3, 10);
+    packed_dna d;
+    d.assign(s.data(), s.size());
+
+    std::unique_ptr<kmer_counter> e1(make_engine<u32>(new tallyman_vec<u32,u32>(13), 7, false, 1));
+    std::unique_ptr<kmer_counter> e2(make_engine<u32>(new tallyman_vec<u32,u32>(13), 7, false, 1));
+    e1->process(s);
+    e2->process(d);
+
+    EXPECT_EQ(results(*e1), results(*e2));
+}
+
+TEST(countengine_test, concurrent_tallymen) {
+    std::vector<std::string> seqs;
+    for (unsigned i = 0; i != 64; ++i)
+        seqs.push_back(random_dna(2000 + i, i));
+
+    for (int variant : { 0, 1 }) {
+        std::unique_ptr<kmer_counter> e(variant
+                ? make_engine<u32>(new tallyman_vec_atomic<u32,u32>(17), 9, false, 4)
+                : make_engine<u32>(new tallyman_vec_private<u32,u32>(17, 4), 9, false, 4));
+        kmer_counter_tally<u32,u32> g(new tallyman_vec<u32,u32>(17), 9, false);
+
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t != 4; ++t)
+            threads.emplace_back([&e, &seqs, t] {
+                    for (size_t i = t; i < seqs.size(); i += 4)
+                        e->process(seqs[i]);
+                });
+        for (auto& t : threads)
+            t.join();
+
+        for (const auto& s : seqs)
+            g.process(s);
+
+        EXPECT_EQ(results(*e), results(g));
+    }
+}
+
+// tallies seqs through the engine on four threads, and checks the results
+// against a single thread generic counter
+
+template <typename tman_t>
+static void
+threaded_crosscheck(tman_t *etman, tallyman<u32,u32> *gtman, const std::vector<std::string>& seqs)
+{
+    std::unique_ptr<kmer_counter> e(make_engine<u32>(etman, 9, false, 4));
+    kmer_counter_tally<u32,u32> g(gtman, 9, false);
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t != 4; ++t)
+        threads.emplace_back([&e, &seqs, t] {
+                for (size_t i = t; i < seqs.size(); i += 4)
+                    e->process(seqs[i]);
+            });
+    for (auto& t : threads)
+        t.join();
+
+    for (const auto& s : seqs)
+        g.process(s);
+
+    EXPECT_EQ(results(*e), results(g));
+}
+
+TEST(countengine_test, locked_tallymen_threaded) {
+
+    // sequences longer than a tally block, so that each thread flushes
+    // several blocks under the lock, and repeats that overflow byte cells
+
+    std::vector<std::string> seqs;
+    for (unsigned i = 0; i != 32; ++i)
+        seqs.push_back(i % 8 ? random_dna(20000 + i, i) : std::string(3000 + i, 'a'));
+
+    threaded_crosscheck(new tallyman_vec<u32,u32>(17), new tallyman_vec<u32,u32>(17), seqs);
+    threaded_crosscheck(new tallyman_vec_compact<u32,u32>(17), new tallyman_vec<u32,u32>(17), seqs);
+}
+
+TEST(countengine_test, prefetching_engine) {
+
+    // a 64MB vector, which the engine tallies in blocks with prefetching
+
+    std::vector<std::string> seqs;
+    for (unsigned i = 0; i != 8; ++i)
+        seqs.push_back(random_dna(20000 + i, i));
+
+    tallyman_vec_atomic<u32,u32> *tman = new tallyman_vec_atomic<u32,u32>(24);
+    EXPECT_TRUE(tman->prefetches());
+
+    std::unique_ptr<kmer_counter> e(make_engine<u32>(tman, 12, true, 2));
+    kmer_counter_tally<u32,u32> g(new tallyman_map<u32,u32>(24), 12, true);
+
+    for (const auto& s : seqs) {
+        e->process(s);
+        g.process(s);
+    }
+
+    std::stringstream sse, ssg;
+    e->write_results(sse, output_opts::invalids);
+    g.write_results(ssg, output_opts::invalids);
+    EXPECT_EQ(sse.str(), ssg.str());
+}
+
+TEST(countengine_test, bits_tallymen_threaded) {
+    std::vector<std::string> seqs;
+    for (unsigned i = 0; i != 32; ++i)
+        seqs.push_back(i % 8 ? random_dna(20000 + i, i) : std::string(3000 + i, 'a'));
+
+    threaded_crosscheck(new tallyman_bits<u32,u32,1>(17), new tallyman_bits<u32,u32,1>(17), seqs);
+    threaded_crosscheck(new tallyman_bits<u32,u32,2>(17), new tallyman_bits<u32,u32,2>(17), seqs);
+}
+
+} // namespace
+// vim: sts=4:sw=4:ai:si:et
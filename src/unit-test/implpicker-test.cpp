@@ -28,9 +28,9 @@ typedef std::uint32_t u32;
 typedef std::uint64_t u64;
 
 std::unique_ptr<kmer_counter>
-pick_impl_wrap(int ks, bool ss = false, unsigned mc = 0, unsigned mg = 0, char fi = '\0')
+pick_impl_wrap(int ks, bool ss = false, unsigned mc = 0, unsigned mg = 0, char fi = '\0', unsigned nt = 1)
 {
-    return std::unique_ptr<kmer_counter>(pick_implementation(ks, ss, mc, mg, fi));
+    return std::unique_ptr<kmer_counter>(pick_implementation(ks, ss, mc, mg, fi, nt));
 }
 
 bool is_tally3232(kmer_counter *p) {
@@ -49,6 +49,28 @@ bool is_tally3264(kmer_counter *p) {
 //    return dynamic_cast<kmer_counter_tally<u64,u64>*>(p) != nullptr;
 //}
 
+// the tallyman of a kmer_counter_tally<kmer_t,count_t>, or null
+
+template <typename kmer_t, typename count_t>
+const tallyman<kmer_t,count_t>* tman_of(kmer_counter *p) {
+    auto t = dynamic_cast<kmer_counter_tally<kmer_t,count_t>*>(p);
+    return t ? t->get_tallyman() : nullptr;
+}
+
+// whether p tallies in a tallyman_vec_private or tallyman_vec_atomic
+
+bool is_private_vec(kmer_counter *p) {
+    auto t = tman_of<u32,u32>(p);
+    return t && t->is_vec() && t->is_concurrent()
+        && dynamic_cast<const tallyman_vec_private<u32,u32>*>(t);
+}
+
+bool is_atomic_vec(kmer_counter *p) {
+    auto t = tman_of<u32,u32>(p);
+    return t && t->is_vec() && t->is_concurrent()
+        && dynamic_cast<const tallyman_vec_atomic<u32,u32>*>(t);
+}
+
 bool is_list32(kmer_counter *p) {
     return dynamic_cast<kmer_counter_list<u32>*>(p) != nullptr;
 }
@@ -122,6 +144,47 @@ TEST(implpicker_test, big_ksize_big_count_is_list64) {
     EXPECT_TRUE(is_list64(pick_impl_wrap(17,false,1<<13).get()));
 }
 
+TEST(implpicker_test, big_ksize_mid_count_is_hash) {
+    // list would take 800MB, vector 32GB, hash at most 6GB
+    for (unsigned nt : { 1, 2 }) {
+        std::unique_ptr<kmer_counter> p(pick_impl_wrap(17,false,100,8,'\0',nt));
+        auto t = tman_of<u64,u32>(p.get());
+        ASSERT_TRUE(t) << nt << " threads";
+        EXPECT_TRUE(t->is_hash()) << nt << " threads";
+    }
+}
+
+TEST(implpicker_test, forced_hash_is_tally) {
+    std::unique_ptr<kmer_counter> p(pick_impl_wrap(9,false,1,0,'h'));
+    auto t = tman_of<u32,u32>(p.get());
+    ASSERT_TRUE(t);
+    EXPECT_TRUE(t->is_hash());
+}
+
+TEST(implpicker_test, big_vec_in_1g_is_compact) {
+    // the 2GB vector does not fit, the 512MB compact vector does
+    std::unique_ptr<kmer_counter> p(pick_impl_wrap(15,false,0,1));
+    std::unique_ptr<kmer_counter> pc(pick_impl_wrap(15,false,0,1,'c'));
+    for (auto t : { tman_of<u32,u32>(p.get()), tman_of<u32,u32>(pc.get()) }) {
+        ASSERT_TRUE(t);
+        EXPECT_TRUE(t->is_compact());
+        EXPECT_TRUE((dynamic_cast<const tallyman_vec_compact<u32,u32>*>(t)));
+    }
+    EXPECT_DEATH(pick_impl_wrap(15,true,0,1,'c'), ".*");
+}
+
+TEST(implpicker_test, bits_are_tally) {
+    std::unique_ptr<kmer_counter> p1(pick_impl_wrap(15,false,0,1,'1'));
+    std::unique_ptr<kmer_counter> p2(pick_impl_wrap(15,true,0,1,'2',2));
+    std::unique_ptr<kmer_counter> p64(pick_impl_wrap(17,false,0,1,'1'));
+    EXPECT_TRUE((dynamic_cast<const tallyman_bits<u32,u32,1>*>(tman_of<u32,u32>(p1.get()))));
+    EXPECT_TRUE((dynamic_cast<const tallyman_bits<u32,u32,2>*>(tman_of<u32,u32>(p2.get()))));
+    EXPECT_TRUE((dynamic_cast<const tallyman_bits<u64,u32,1>*>(tman_of<u64,u32>(p64.get()))));
+    EXPECT_EQ((tman_of<u32,u32>(p1.get())->count_cap()), 1);
+    EXPECT_EQ((tman_of<u32,u32>(p2.get())->count_cap()), 3);
+    EXPECT_DEATH(pick_impl_wrap(19,false,0,1,'2'), ".*");
+}
+
 // errors for user specified ----------------------------------------------
 
 TEST(implpicker_test, exceed_1g) {
@@ -154,6 +217,54 @@ TEST(implpicker_test, force_lst_impl64) {
     EXPECT_TRUE(is_list64(pick_impl_wrap(17,false,2,0,'l').get()));
 }
 
+// threads ----------------------------------------------------------------
+
+TEST(implpicker_test, threaded_vec_is_concurrent) {
+    std::unique_ptr<kmer_counter> p1(pick_impl_wrap(7,false,1,0,'\0',1));
+    std::unique_ptr<kmer_counter> p4(pick_impl_wrap(7,false,1,0,'\0',4));
+    // the small vectors fit comfortably, so each thread gets its own
+    EXPECT_TRUE(is_private_vec(p4.get()));
+    EXPECT_FALSE((tman_of<u32,u32>(p1.get())->is_concurrent()));
+    std::stringstream ss1, ss4;
+    p1->process("acgtacgtacgtn");
+    p4->process("acgtacgtacgtn");
+    p1->write_results(ss1, output_opts::invalids);
+    p4->write_results(ss4, output_opts::invalids);
+    EXPECT_EQ(ss1.str(), ss4.str());
+}
+
+TEST(implpicker_test, force_map_impl_threaded) {
+    std::unique_ptr<kmer_counter> p1(pick_impl_wrap(9,true,2,0,'m',1));
+    std::unique_ptr<kmer_counter> p4(pick_impl_wrap(9,true,2,0,'m',4));
+    EXPECT_TRUE(is_tally3232(p4.get()));
+    std::stringstream ss1, ss4;
+    p1->process("acgtacgtacgtnttttgggcccaaatttacgatcgatcgatgcatgcatgcat");
+    p4->process("acgtacgtacgtnttttgggcccaaatttacgatcgatcgatgcatgcatgcat");
+    p1->write_results(ss1, output_opts::invalids);
+    p4->write_results(ss4, output_opts::invalids);
+    EXPECT_EQ(ss1.str(), ss4.str());
+}
+
+TEST(implpicker_test, threaded_large_vec_is_concurrent) {
+    // at 1GB the four vectors of 128MB do not fit comfortably, so this is
+    // the shared atomic vector rather than private vectors
+    std::unique_ptr<kmer_counter> p1(pick_impl_wrap(13,false,1,1,'v',1));
+    std::unique_ptr<kmer_counter> p4(pick_impl_wrap(13,false,1,1,'v',4));
+    EXPECT_TRUE(is_atomic_vec(p4.get()));
+    std::stringstream ss1, ss4;
+    p1->process("acgtacgtacgtnttttgggcccaaatttacgatcgatcgatgcatgcatgcat");
+    p4->process("acgtacgtacgtnttttgggcccaaatttacgatcgatcgatgcatgcatgcat");
+    p1->write_results(ss1, output_opts::invalids);
+    p4->write_results(ss4, output_opts::invalids);
+    EXPECT_EQ(ss1.str(), ss4.str());
+}
+
+TEST(implpicker_test, force_vec_impl_threaded) {
+    // in 1GB, two vectors of 128MB fit comfortably, three do not
+    EXPECT_TRUE(is_private_vec(pick_impl_wrap(13,false,2,1,'v',2).get()));
+    EXPECT_TRUE(is_atomic_vec(pick_impl_wrap(13,false,2,1,'v',3).get()));
+}
+
 
 } // namespace
   // vim: sts=4:sw=4:ai:si:et
@@ -16,9 +16,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string>
+#include <vector>
 #include <gtest/gtest.h>
 #include "kmercodec.h"
 #include "utils.h"
+#include "testutils.h"
 
 using namespace kfc;
 
@@ -548,7 +551,7 @@ TEST(kmercodec_test, invalid64) {
 
 TEST(kmercodec_test, invalid64_mid) {
     char seq[] = "aaaacngtttt";
-    std::uint64_t res[5];
+    std::uint64_t res[7];
     ds_encode<std::uint64_t,5>(seq, seq+sizeof(seq)-1, res);
     EXPECT_EQ(res[0], 1);
     EXPECT_TRUE(res[1] & high_bit<std::uint64_t>);
@@ -560,5 +563,102 @@ TEST(kmercodec_test, invalid64_mid) {
 }
 
 
+// rolling ds_encode against ds_encode_one ------------------------------
+
+template <typename kmer_t, unsigned ksize>
+void
+crosscheck_ds_rolling(unsigned seed)
+{
+    std::string seq = random_bases(2000, seed, "acgtACGTn");
+
+    std::vector<kmer_t> res(seq.size() - ksize + 1);
+    ds_encode<kmer_t,ksize>(seq.data(), seq.data() + seq.size(), res.data());
+
+    for (size_t i = 0; i != res.size(); ++i) {
+        kmer_t one = ds_encode_one<kmer_t,ksize>(seq.data() + i);
+        if (one & high_bit<kmer_t>)
+            EXPECT_TRUE(res[i] & high_bit<kmer_t>) << "at " << i;
+        else
+            EXPECT_EQ(one, res[i]) << "at " << i;
+    }
+}
+
+TEST(kmercodec_test, ds_rolling_crosscheck) {
+    crosscheck_ds_rolling<std::uint32_t,1>(1);
+    crosscheck_ds_rolling<std::uint32_t,3>(2);
+    crosscheck_ds_rolling<std::uint32_t,11>(3);
+    crosscheck_ds_rolling<std::uint32_t,15>(4);
+    crosscheck_ds_rolling<std::uint64_t,3>(5);
+    crosscheck_ds_rolling<std::uint64_t,17>(6);
+    crosscheck_ds_rolling<std::uint64_t,31>(7);
+}
+
+
+// ss_encode plus ss_to_ds_range against ds_encode ----------------------
+
+template <typename kmer_t, unsigned ksize>
+void
+crosscheck_ss_to_ds_range(unsigned seed)
+{
+    std::string seq = random_bases(2000, seed, "acgtACGTn");
+
+    std::vector<kmer_t> ds(seq.size() - ksize + 1), ss(ds.size());
+    ds_encode<kmer_t,ksize>(seq.data(), seq.data() + seq.size(), ds.data());
+    ss_encode<kmer_t,ksize>(seq.data(), seq.data() + seq.size(), ss.data());
+    ss_to_ds_range<kmer_t,ksize>(ss.data(), ss.data() + ss.size());
+
+    for (size_t i = 0; i != ds.size(); ++i)
+        if (ds[i] & high_bit<kmer_t>)
+            EXPECT_TRUE(ss[i] & high_bit<kmer_t>) << "at " << i;
+        else
+            EXPECT_EQ(ds[i], ss[i]) << "at " << i;
+}
+
+TEST(kmercodec_test, ss_to_ds_range_crosscheck) {
+    crosscheck_ss_to_ds_range<std::uint32_t,1>(1);
+    crosscheck_ss_to_ds_range<std::uint32_t,7>(2);
+    crosscheck_ss_to_ds_range<std::uint32_t,15>(3);
+    crosscheck_ss_to_ds_range<std::uint64_t,5>(4);
+    crosscheck_ss_to_ds_range<std::uint64_t,21>(5);
+    crosscheck_ss_to_ds_range<std::uint64_t,31>(6);
+}
+
+template <typename kmer_t, unsigned ksize>
+static void
+crosscheck_decode_to(unsigned seed)
+{
+    char buf[ksize + 1];
+    buf[ksize] = '#';
+
+    test_lcg rng(seed);
+    for (int i = 0; i != 200; ++i) {
+        std::uint32_t x = rng();
+        kmer_t kmer = (kmer_t(x) << 16 ^ x) & low_bits<kmer_t,2*ksize>;
+        if (i % 50 == 0)
+            kmer |= high_bit<kmer_t>;
+        for (bool rc : { false, true }) {
+            ASSERT_EQ((ss_decode_to<kmer_t,ksize>(kmer, buf, rc)), buf + ksize);
+            ASSERT_EQ(std::string(buf, ksize), (ss_decode<kmer_t,ksize>(kmer, rc))) << "k" << ksize << " at " << i;
+            ASSERT_EQ(buf[ksize], '#');
+            if (ksize & 1) {
+                kmer_t dkmer = kmer & high_bit<kmer_t> ? kmer : kmer >> 1;
+                ASSERT_EQ((ds_decode_to<kmer_t,ksize|1>(dkmer, buf, rc)), buf + ksize);
+                ASSERT_EQ(std::string(buf, ksize), (ds_decode<kmer_t,ksize|1>(dkmer, rc))) << "k" << ksize << " at " << i;
+            }
+        }
+    }
+}
+
+TEST(kmercodec_test, decode_to_crosscheck) {
+    crosscheck_decode_to<std::uint32_t,1>(1);
+    crosscheck_decode_to<std::uint32_t,3>(2);
+    crosscheck_decode_to<std::uint32_t,4>(3);
+    crosscheck_decode_to<std::uint32_t,8>(4);
+    crosscheck_decode_to<std::uint32_t,15>(5);
+    crosscheck_decode_to<std::uint64_t,16>(6);
+    crosscheck_decode_to<std::uint64_t,21>(7);
+    crosscheck_decode_to<std::uint64_t,31>(8);
+}
+
 } // namespace
   // vim: sts=4:sw=4:ai:si:et
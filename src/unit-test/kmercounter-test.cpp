@@ -16,9 +16,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <thread>
 #include <gtest/gtest.h>
 #include "kmercounter.h"
 #include "utils.h"
+#include "testutils.h"
 
 using namespace kfc;
 
@@ -510,5 +512,202 @@ TEST(kmercounter_test, counter64_1kbase_crosscheck_ss) {
     ASSERT_EQ(ss1.str(), ss2.str());
 }
 
+TEST(kmercounter_test, list_capacity_exhausted) {
+    counter32list c(3, false, 4);
+    c.process("acgtac");
+    EXPECT_DEATH(c.process("acg"), ".*");
+}
+
+TEST(kmercounter_test, list_concurrent_process) {
+    const int n_threads = 8;
+    const int n_rounds = 50;
+
+    counter32list c1(15, false, KBASE * n_threads * n_rounds);
+    counter32list c2(15, false, KBASE * n_threads * n_rounds);
+
+    for (int i = 0; i < n_threads * n_rounds; ++i)
+        c1.process(dna);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n_threads; ++i)
+        threads.emplace_back([&c2] {
+            for (int j = 0; j < n_rounds; ++j)
+                c2.process(dna);
+        });
+    for (auto& t : threads)
+        t.join();
+
+    std::stringstream ss1;
+    std::stringstream ss2;
+
+    c1.write_results(ss1, output_opts::invalids);
+    c2.write_results(ss2, output_opts::invalids);
+
+    ASSERT_EQ(ss1.str(), ss2.str());
+}
+
+TEST(kmercounter_test, multi_block_output) {
+
+    // over 2^20 k-mers and k-mer values, so output is written in several
+    // blocks; the outputs on 1 and 4 threads, and of vec and list must agree
+
+    std::string seq = random_bases(3000000, 11, "acgtn");
+
+    for (unsigned opts : { unsigned(output_opts::invalids), unsigned(output_opts::zeros) }) {
+        counter32list l1(11, false, seq.size(), 1);
+        counter32list l4(11, false, seq.size(), 4);
+        counter32tally v4(new tallyman_vec<std::uint32_t,std::uint32_t>(21), 11, false, 4);
+
+        l1.process(seq);
+        l4.process(seq);
+        v4.process(seq);
+
+        std::stringstream ss1, ss4, ssv;
+        l1.write_results(ss1, opts);
+        l4.write_results(ss4, opts);
+        v4.write_results(ssv, opts);
+
+        EXPECT_EQ(ss1.str(), ss4.str());
+        EXPECT_EQ(ss1.str().substr(ss1.str().find('\n')), ssv.str().substr(ssv.str().find('\n')));
+    }
+}
+
+TEST(kmercounter_test, tally_in_blocks) {
+
+    // long enough to be encoded and tallied in several blocks, with
+    // invalid bases around the block boundaries; string and packed input
+    // must give what the list gives
+
+    std::string seq = random_bases(100000, 5, "acgt");
+    for (size_t p : { 8190, 8192, 8197, 16384 + 3, 40000 })
+        seq[p] = 'n';
+
+    packed_dna d;
+    d.assign(seq.data(), seq.size());
+
+    for (bool ss : { false, true }) {
+        counter32list l(9, ss, seq.size());
+        counter32tally t(new tallyman_vec<std::uint32_t,std::uint32_t>(ss ? 18 : 17), 9, ss);
+        counter32tally m(new tallyman_map<std::uint32_t,std::uint32_t>(ss ? 18 : 17), 9, ss);
+
+        l.process(seq);
+        t.process(seq);
+        m.process(d);
+
+        std::stringstream ssl, sst, ssm;
+        l.write_results(ssl, output_opts::invalids);
+        t.write_results(sst, output_opts::invalids);
+        m.write_results(ssm, output_opts::invalids);
+
+        EXPECT_EQ(ssl.str(), sst.str());
+        EXPECT_EQ(ssl.str(), ssm.str());
+    }
+}
+
+TEST(kmercounter_test, skip_invalid_runs) {
+
+    // a long run of n's is skipped, not stored: the list has room for the
+    // valid k-mers only, yet the invalid count includes the skipped ones
+
+    std::string seq = std::string(50, 'a') + std::string(100000, 'n') + "acgtacgtac" + "x" + std::string(20, 'c');
+
+    for (bool ss : { false, true }) {
+        counter32list l(9, ss, 42 + 2 + 12);
+        counter32tally t(new tallyman_vec<std::uint32_t,std::uint32_t>(ss ? 18 : 17), 9, ss);
+
+        l.process(seq);
+        t.process(seq);
+
+        std::stringstream ssl, sst;
+        l.write_results(ssl, output_opts::invalids);
+        t.write_results(sst, output_opts::invalids);
+
+        EXPECT_EQ(ssl.str(), sst.str());
+        EXPECT_NE(ssl.str().find("\t" + std::to_string(seq.size() - 8 - 56) + "\n"), std::string::npos);
+    }
+}
+
+TEST(kmercounter_test, compact_counts_past_cells) {
+
+    // a repeat makes some k-mers overflow their byte cells, and a zero
+    // count output crosses the output blocks; must give what the vector gives
+
+    std::string seq;
+    for (int i = 0; i != 400; ++i)
+        seq += "acgtgca";
+    seq += "ttagc";
+
+    for (bool ss : { false, true }) {
+        counter32tally t(new tallyman_vec<std::uint32_t,std::uint32_t>(ss ? 22 : 21), 11, ss);
+        counter32tally c(new tallyman_vec_compact<std::uint32_t,std::uint32_t>(ss ? 22 : 21), 11, ss);
+
+        t.process(seq);
+        c.process(seq);
+
+        std::stringstream sst, ssc;
+        t.write_results(sst, with_zeros | output_opts::invalids);
+        c.write_results(ssc, with_zeros | output_opts::invalids);
+
+        EXPECT_EQ(sst.str(), ssc.str());
+
+        std::uint64_t kmer, count, max_count = 0;
+        std::string dna;
+        while (ssc >> dna >> kmer >> count)
+            max_count = std::max(max_count, count);
+        EXPECT_GT(max_count, 255);
+    }
+}
+
+TEST(kmercounter_test, bits_cap_counts) {
+
+    // the bit vectors give the counts of the vector, capped at 1 resp. 3
+
+    std::string seq("aaaaaaacgtnaaacgtacgttt");
+
+    counter32tally v(new tallyman_vec<std::uint32_t,std::uint32_t>(5), 3, false);
+    counter32tally b(new tallyman_bits<std::uint32_t,std::uint32_t,1>(5), 3, false);
+    counter32tally c(new tallyman_bits<std::uint32_t,std::uint32_t,2>(5), 3, false);
+
+    v.process(seq);
+    b.process(seq);
+    c.process(seq);
+
+    std::stringstream ssv, ssb, ssc;
+    v.write_results(ssv, std_opts);
+    b.write_results(ssb, std_opts);
+    c.write_results(ssc, std_opts);
+
+    std::string cap1, cap3, dna;
+    std::uint64_t kmer, count, max_count = 0;
+    while (ssv >> dna >> kmer >> count) {
+        cap1 += dna + "\t" + std::to_string(kmer) + "\t1\n";
+        cap3 += dna + "\t" + std::to_string(kmer) + "\t" + std::to_string(std::min(count, std::uint64_t(3))) + "\n";
+        max_count = std::max(max_count, count);
+    }
+
+    EXPECT_GT(max_count, 3);
+    EXPECT_EQ(ssb.str(), cap1);
+    EXPECT_EQ(ssc.str(), cap3);
+}
+
+TEST(kmercounter_test, bits_mode_in_header) {
+    counter32tally v(new tallyman_vec<std::uint32_t,std::uint32_t>(5), 3, false);
+    counter32tally b(new tallyman_bits<std::uint32_t,std::uint32_t,1>(5), 3, false);
+    counter32tally c(new tallyman_bits<std::uint32_t,std::uint32_t,2>(5), 3, false);
+
+    std::string hv, hb, hc;
+    std::stringstream ssv, ssb, ssc;
+    v.write_results(ssv);
+    b.write_results(ssb);
+    c.write_results(ssc);
+    std::getline(ssv, hv);
+    std::getline(ssb, hb);
+    std::getline(ssc, hc);
+
+    EXPECT_EQ(hv, "# kfc 3-mer counts (canonical, destranded); omitting zero counts");
+    EXPECT_EQ(hb, "# kfc 3-mer counts (canonical, destranded); presence only, 1 means present; omitting zero counts");
+    EXPECT_EQ(hc, "# kfc 3-mer counts (canonical, destranded); capped, 3 means 3 or more; omitting zero counts");
+}
+
 } // namespace
   // vim: sts=4:sw=4:ai:si:et
@@ -411,5 +411,146 @@ TEST(kmerencoder_test, encoder64_1kbase_rc) {
     }
 }
 
+// kernels ------------------------------------------------------------
+
+TEST(kmerencoder_test, default_kernel_is_best) {
+    encoder32 c(15);
+    ASSERT_EQ(c.kernel(), best_pack_kernel());
+}
+
+TEST(kmerencoder_test, kernels_agree) {
+    std::string dna;
+    for (unsigned i = 0; i != 3*KBASE; ++i)
+        dna.push_back(std::rand() % 50 ? "acgtACGT"[std::rand() % 8] : 'N');
+
+    for (pack_kernel k : { pack_kernel::sse42, pack_kernel::avx2, pack_kernel::avx512bw }) {
+        if (!pack_kernel_supported(k))
+            continue;
+        for (unsigned ksize : { 1, 7, 15 }) {
+            ASSERT_EQ(encoder32(ksize, false, k).encode(dna), encoder32(ksize, false, pack_kernel::scalar).encode(dna));
+            ASSERT_EQ(encoder32(ksize, true, k).encode(dna), encoder32(ksize, true, pack_kernel::scalar).encode(dna));
+        }
+        for (unsigned ksize : { 17, 31 }) {
+            ASSERT_EQ(encoder64(ksize, false, k).encode(dna), encoder64(ksize, false, pack_kernel::scalar).encode(dna));
+            ASSERT_EQ(encoder64(ksize, true, k).encode(dna), encoder64(ksize, true, pack_kernel::scalar).encode(dna));
+        }
+    }
+}
+
+TEST(kmerencoder_test, canonicalise) {
+    std::string dna;
+    for (unsigned i = 0; i != 3*KBASE; ++i)
+        dna.push_back(std::rand() % 50 ? "acgtACGT"[std::rand() % 8] : 'N');
+
+    for (pack_kernel k : { pack_kernel::scalar, pack_kernel::avx2 }) {
+        if (!pack_kernel_supported(k))
+            continue;
+        for (unsigned ksize : { 1, 7, 15 }) {
+            vector32 v = encoder32(ksize, true, k).encode(dna), w = v;
+            encoder32(ksize, true, k).canonicalise(w.data(), w.data() + w.size());
+            ASSERT_EQ(v, w);
+            encoder32(ksize, false, k).canonicalise(v.data(), v.data() + v.size());
+            ASSERT_EQ(v, encoder32(ksize, false, k).encode(dna));
+        }
+        for (unsigned ksize : { 17, 31 }) {
+            vector64 v = encoder64(ksize, true, k).encode(dna);
+            encoder64(ksize, false, k).canonicalise(v.data(), v.data() + v.size());
+            ASSERT_EQ(v, encoder64(ksize, false, k).encode(dna));
+        }
+    }
+}
+
+// packed_dna ---------------------------------------------------------
+
+template <typename kmer_t>
+static void
+check_packed_encode(const std::string& dna, unsigned ksize, bool ss)
+{
+    kmer_encoder<kmer_t> c(ksize, ss);
+    packed_dna d;
+    d.assign(dna.data(), dna.size());
+
+    std::vector<kmer_t> e = c.encode(dna);
+    std::vector<kmer_t> p = c.encode(d);
+
+    ASSERT_EQ(e.size(), p.size());
+    for (size_t i = 0; i != e.size(); ++i) {
+        ASSERT_EQ(c.is_invalid(e[i]), c.is_invalid(p[i])) << "k" << ksize << " at " << i;
+        if (!c.is_invalid(e[i])) {
+            ASSERT_EQ(e[i], p[i]) << "k" << ksize << " at " << i;
+        }
+    }
+}
+
+TEST(kmerencoder_test, packed_dna_encode) {
+    std::string dna;
+    for (unsigned i = 0; i != 3*KBASE; ++i)
+        dna.push_back(std::rand() % 40 ? "acgtACGT"[std::rand() % 8] : 'N');
+    dna.replace(100, 40, 40, 'n');
+
+    for (unsigned ksize : { 1, 2, 8, 15 })
+        check_packed_encode<std::uint32_t>(dna, ksize, true);
+    for (unsigned ksize : { 1, 9, 15 })
+        check_packed_encode<std::uint32_t>(dna, ksize, false);
+    for (unsigned ksize : { 16, 31 })
+        check_packed_encode<std::uint64_t>(dna, ksize, true);
+    for (unsigned ksize : { 17, 31 })
+        check_packed_encode<std::uint64_t>(dna, ksize, false);
+
+    check_packed_encode<std::uint32_t>(dna.substr(0, 15), 15, false);
+    check_packed_encode<std::uint32_t>(dna.substr(0, 14), 15, false);
+}
+
+TEST(kmerencoder_test, packed_dna_encode_range) {
+    std::string dna;
+    for (unsigned i = 0; i != 3*KBASE; ++i)
+        dna.push_back(std::rand() % 40 ? "acgt"[std::rand() % 4] : 'n');
+    dna.replace(500, 40, 40, 'n');
+
+    packed_dna d;
+    d.assign(dna.data(), dna.size());
+
+    for (bool ss : { false, true }) {
+        encoder32 c(15, ss);
+        for (size_t pos : { 0, 1, 31, 32, 490, 520, 1000 })
+            for (size_t n : { 15, 16, 50, 100, 1000 }) {
+                vector32 e = c.encode(dna.substr(pos, n));
+                vector32 p(n - 14);
+                c.encode(d, pos, n, p.data());
+                for (size_t i = 0; i != e.size(); ++i) {
+                    ASSERT_EQ(c.is_invalid(e[i]), c.is_invalid(p[i])) << pos << "+" << n << " at " << i;
+                    if (!c.is_invalid(e[i])) {
+                        ASSERT_EQ(e[i], p[i]) << pos << "+" << n << " at " << i;
+                    }
+                }
+            }
+    }
+}
+
+TEST(kmerencoder_test, decode_to_buffer) {
+
+    // the ss kmers of a string decode back to back to its bases at every
+    // ksize-th position; append_decoded appends what decode gives
+
+    for (unsigned ksize : { 1, 4, 9, 15 }) {
+        encoder32 c(ksize, true);
+        vector32 r = c.encode(dna);
+        vector32 every;
+        std::string exp;
+        for (size_t i = 0; i < r.size(); i += ksize) {
+            every.push_back(r[i]);
+            exp.append(dna + i, ksize);
+        }
+
+        std::string buf(exp.size(), '#');
+        EXPECT_EQ(c.decode(every.data(), every.data() + every.size(), &buf[0]), &buf[0] + buf.size());
+        EXPECT_EQ(buf, exp);
+
+        std::string app("x");
+        c.append_decoded(app, r[7]);
+        EXPECT_EQ(app, "x" + c.decode(r[7]));
+    }
+}
+
 } // namespace
   // vim: sts=4:sw=4:ai:si:et
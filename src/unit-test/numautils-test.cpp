@@ -0,0 +1,52 @@
+/* numautils-test.cpp
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include "numautils.h"
+
+using namespace kfc;
+
+namespace {
+
+TEST(numautils_test, at_least_one_node) {
+    EXPECT_GE(get_numa_nodes(), 1);
+}
+
+TEST(numautils_test, calloc_small) {
+    const size_t n = 1000;
+    unsigned char *p = (unsigned char*) interleaved_calloc(n);
+    ASSERT_NE(p, nullptr);
+    for (size_t i = 0; i < n; ++i)
+        ASSERT_EQ(p[i], 0);
+    p[n-1] = 1;
+    interleaved_free(p, n);
+}
+
+TEST(numautils_test, calloc_large) {
+    const size_t n = interleave_min_bytes;
+    unsigned char *p = (unsigned char*) interleaved_calloc(n);
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(p[0], 0);
+    EXPECT_EQ(p[n/2], 0);
+    EXPECT_EQ(p[n-1], 0);
+    p[n-1] = 1;
+    interleaved_free(p, n);
+}
+
+} // namespace
+  // vim: sts=4:sw=4:ai:si:et
@@ -0,0 +1,215 @@
+/* pipeline-test.cpp
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <gtest/gtest.h>
+#include "pipeline.h"
+#include "seqreader.h"
+#include "testutils.h"
+
+using namespace kfc;
+
+namespace {
+
+typedef kmer_counter_list<std::uint32_t> counter32list;
+typedef kmer_counter_tally<std::uint32_t,std::uint32_t> counter32tally;
+
+static const char *ecoli_fname = "data/ecoli.fa.gz";
+
+static tallyman<std::uint32_t,std::uint32_t>*
+tvec32(int ks, bool ss = false) { return new tallyman_vec<std::uint32_t,std::uint32_t>(2*ks-(ss?0:1)); }
+
+static tallyman<std::uint32_t,std::uint32_t>*
+tmap32(int ks, bool ss = false) { return new tallyman_map<std::uint32_t,std::uint32_t>(2*ks-(ss?0:1)); }
+
+static tallyman<std::uint32_t,std::uint32_t>*
+thash32(int ks, bool ss = false) { return new tallyman_hash<std::uint32_t,std::uint32_t>(2*ks-(ss?0:1)); }
+
+// count the test genome on n_threads, return the output
+
+static std::string
+count_ecoli(kmer_counter& c, unsigned n_threads, unsigned opts = output_opts::none,
+        size_t chunk = 0, bool packed = false)
+{
+    std::ifstream f(ecoli_fname, std::ios_base::in|std::ios_base::binary);
+    sequence_reader r(f);
+    r.set_chunking(chunk, c.ksize() - 1);
+    r.set_packing(packed);
+    sequence s;
+
+    counting_pipeline p(c, n_threads);
+    while (r.next(s))
+        if (packed)
+            p.process(std::move(s.packed));
+        else
+            p.process(std::move(s.data));
+    p.finish();
+
+    std::stringstream ss;
+    c.write_results(ss, opts | output_opts::invalids);
+    return ss.str();
+}
+
+// count a large number of short reads on n_threads, return the output
+
+static std::string
+count_reads(kmer_counter& c, unsigned n_threads)
+{
+    test_lcg rng(42);
+
+    counting_pipeline p(c, n_threads);
+    for (int i = 0; i < 20000; ++i) {
+        std::string read(150, 'a');
+        for (auto& b : read)
+            b = "acgtn"[(rng() >> 16) % 5];
+        p.process(std::move(read));
+    }
+    p.finish();
+
+    std::stringstream ss;
+    c.write_results(ss, output_opts::invalids);
+    return ss.str();
+}
+
+TEST(pipeline_test, single_thread_is_inline) {
+    counter32tally c(tvec32(3), 3, false);
+    counting_pipeline p(c, 1);
+    p.process("acgt");
+    std::stringstream ss;
+    c.write_results(ss, output_opts::no_headers);
+    EXPECT_EQ(ss.str(), "acg\t6\t2\n");
+}
+
+TEST(pipeline_test, zero_threads_is_one) {
+    counter32tally c(tvec32(3), 3, false);
+    counting_pipeline p(c, 0);
+    EXPECT_EQ(p.n_threads(), 1);
+}
+
+TEST(pipeline_test, finish_twice) {
+    counter32tally c(tvec32(3), 3, false);
+    counting_pipeline p(c, 4);
+    p.process("acgt");
+    p.finish();
+    p.finish();
+    std::stringstream ss;
+    c.write_results(ss, output_opts::no_headers);
+    EXPECT_EQ(ss.str(), "acg\t6\t2\n");
+}
+
+TEST(pipeline_test, ecoli_vec_threads) {
+    counter32tally c1(tvec32(11), 11, false);
+    counter32tally c4(tvec32(11), 11, false);
+    EXPECT_EQ(count_ecoli(c1, 1), count_ecoli(c4, 4));
+}
+
+TEST(pipeline_test, ecoli_map_threads) {
+    counter32tally c1(tmap32(9, true), 9, true);
+    counter32tally c4(tmap32(9, true), 9, true);
+    EXPECT_EQ(count_ecoli(c1, 1), count_ecoli(c4, 4));
+}
+
+TEST(pipeline_test, ecoli_hash_threads) {
+    counter32tally c1(thash32(13), 13, false);
+    counter32tally c4(thash32(13), 13, false);
+    EXPECT_EQ(count_ecoli(c1, 1), count_ecoli(c4, 4));
+}
+
+TEST(pipeline_test, ecoli_list_threads) {
+    counter32list c1(13, false, 1<<24);
+    counter32list c4(13, false, 1<<24);
+    EXPECT_EQ(count_ecoli(c1, 1), count_ecoli(c4, 4));
+}
+
+TEST(pipeline_test, ecoli_chunked_reader) {
+    counter32tally c1(tvec32(11), 11, false);
+    counter32tally c4(tvec32(11), 11, false);
+    EXPECT_EQ(count_ecoli(c1, 1), count_ecoli(c4, 4, output_opts::none, 100000));
+}
+
+TEST(pipeline_test, ecoli_packed) {
+    counter32tally c1(tvec32(11), 11, false);
+    counter32tally c4(tvec32(11), 11, false);
+    EXPECT_EQ(count_ecoli(c1, 1), count_ecoli(c4, 4, output_opts::none, 100000, true));
+}
+
+TEST(pipeline_test, ecoli_packed_list) {
+    counter32list c1(12, true, 1<<24);
+    counter32list c4(12, true, 1<<24);
+    EXPECT_EQ(count_ecoli(c1, 1), count_ecoli(c4, 4, output_opts::none, 0, true));
+}
+
+TEST(pipeline_test, long_sequence_chunked) {
+    std::string seq = random_bases(3 * counting_pipeline::chunk_bases + 1234, 7, "acgt");
+    counter32list c1(9, false, 1<<23);
+    counter32list c4(9, false, 1<<23);
+    counting_pipeline(c1, 1).process(std::string(seq));
+    counting_pipeline(c4, 4).process(std::string(seq));
+    std::stringstream s1, s4;
+    c1.write_results(s1, output_opts::invalids);
+    c4.write_results(s4, output_opts::invalids);
+    EXPECT_EQ(s1.str(), s4.str());
+}
+
+TEST(pipeline_test, long_packed_sequence_chunked) {
+    std::string seq = random_bases(3 * counting_pipeline::chunk_bases + 1234, 11, "acgtn");
+    packed_dna d;
+    d.assign(seq.data(), seq.size());
+    counter32list c1(9, false, 1<<23);
+    counter32list c4(9, false, 1<<23);
+    counting_pipeline(c1, 1).process(std::string(seq));
+    counting_pipeline(c4, 4).process(std::move(d));
+    std::stringstream s1, s4;
+    c1.write_results(s1, output_opts::invalids);
+    c4.write_results(s4, output_opts::invalids);
+    EXPECT_EQ(s1.str(), s4.str());
+}
+
+TEST(pipeline_test, tail_beyond_slack_chunked) {
+    std::string seq = random_bases(2 * counting_pipeline::chunk_bases + counting_pipeline::chunk_slack + 1000, 13, "acgtn");
+    packed_dna d;
+    d.assign(seq.data(), seq.size());
+    counter32list c1(9, false, 1<<23);
+    counter32list c4(9, false, 1<<23);
+    counter32list p4(9, false, 1<<23);
+    counting_pipeline(c1, 1).process(std::string(seq));
+    counting_pipeline(c4, 4).process(std::string(seq));
+    counting_pipeline(p4, 4).process(std::move(d));
+    std::stringstream s1, s4, sp;
+    c1.write_results(s1, output_opts::invalids);
+    c4.write_results(s4, output_opts::invalids);
+    p4.write_results(sp, output_opts::invalids);
+    EXPECT_EQ(s1.str(), s4.str());
+    EXPECT_EQ(s1.str(), sp.str());
+}
+
+TEST(pipeline_test, reads_vec_threads) {
+    counter32tally c1(tvec32(7), 7, false);
+    counter32tally c8(tvec32(7), 7, false);
+    EXPECT_EQ(count_reads(c1, 1), count_reads(c8, 8));
+}
+
+TEST(pipeline_test, reads_list_threads) {
+    counter32list c1(7, false, 1<<22);
+    counter32list c8(7, false, 1<<22);
+    EXPECT_EQ(count_reads(c1, 1), count_reads(c8, 8));
+}
+
+} // namespace
+  // vim: sts=4:sw=4:ai:si:et
@@ -0,0 +1,138 @@
+/* radixsort-test.cpp
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+#include "radixsort.h"
+
+using namespace kfc;
+
+namespace {
+
+// random_kmers - n values of nbits, of which about one in 'invalid' invalid
+
+template <typename kmer_t>
+static std::vector<kmer_t>
+random_kmers(size_t n, unsigned nbits, unsigned invalid = 0)
+{
+    std::mt19937_64 rng(nbits * 7919 + n);
+    std::vector<kmer_t> v(n);
+    kmer_t mask = (kmer_t(1) << nbits) - 1;
+
+    for (auto& k : v) {
+        k = static_cast<kmer_t>(rng()) & mask;
+        if (invalid && rng() % invalid == 0)
+            k = static_cast<kmer_t>(rng()) | high_bit<kmer_t>;
+    }
+
+    return v;
+}
+
+// check_sort - radix sort v and check against std::sort on the valid part
+
+template <typename kmer_t>
+static void
+check_sort(std::vector<kmer_t> v, unsigned nbits, unsigned n_threads)
+{
+    std::vector<kmer_t> expect(v);
+    std::sort(expect.begin(), expect.end());
+
+    radix_sort(v.data(), v.data() + v.size(), nbits, n_threads);
+
+    size_t n_valid = std::find_if(expect.begin(), expect.end(),
+            [](kmer_t k) { return (k & high_bit<kmer_t>) != 0; }) - expect.begin();
+
+    for (size_t i = 0; i != n_valid; ++i)
+        ASSERT_EQ(v[i], expect[i]) << "at index " << i;
+
+    for (size_t i = n_valid; i != v.size(); ++i)
+        ASSERT_TRUE(v[i] & high_bit<kmer_t>) << "at index " << i;
+}
+
+TEST(radixsort_test, no_bits_zero) {
+    std::uint32_t v[2] = { 1, 0 };
+    EXPECT_DEATH(radix_sort(v, v+2, 0), ".*");
+}
+
+TEST(radixsort_test, no_bits_32) {
+    std::uint32_t v[2] = { 1, 0 };
+    EXPECT_DEATH(radix_sort(v, v+2, 32), ".*");
+}
+
+TEST(radixsort_test, empty_and_one) {
+    std::uint32_t v[1] = { 3 };
+    radix_sort(v, v, 2);
+    radix_sort(v, v+1, 2);
+    EXPECT_EQ(v[0], 3);
+}
+
+TEST(radixsort_test, small_sorted) {
+    std::vector<std::uint32_t> v = { 3, 0, high_bit<std::uint32_t>, 2, 1, 3 };
+    radix_sort(v.data(), v.data() + v.size(), 2);
+    EXPECT_EQ(v, std::vector<std::uint32_t>({ 0, 1, 2, 3, 3, high_bit<std::uint32_t> }));
+}
+
+TEST(radixsort_test, one_bit) {
+    check_sort(random_kmers<std::uint32_t>(1000, 1, 10), 1, 1);
+}
+
+TEST(radixsort_test, bits_32) {
+    for (unsigned b : { 5, 8, 11, 12, 19, 29, 31 })
+        check_sort(random_kmers<std::uint32_t>(100000, b, 20), b, 1);
+}
+
+TEST(radixsort_test, bits_64) {
+    for (unsigned b : { 3, 11, 33, 61, 62, 63 })
+        check_sort(random_kmers<std::uint64_t>(100000, b, 20), b, 1);
+}
+
+TEST(radixsort_test, all_invalid) {
+    check_sort(random_kmers<std::uint32_t>(1000, 7, 1), 7, 1);
+}
+
+TEST(radixsort_test, all_equal) {
+    check_sort(std::vector<std::uint64_t>(200000, 12345), 29, 4);
+}
+
+TEST(radixsort_test, threads_32) {
+    check_sort(random_kmers<std::uint32_t>(1000000, 29, 50), 29, 4);
+}
+
+TEST(radixsort_test, threads_64) {
+    check_sort(random_kmers<std::uint64_t>(1000000, 61, 50), 61, 8);
+}
+
+TEST(radixsort_test, threads_skewed) {
+    // most values in one top bucket, so that the threads' stripes of the
+    // other buckets overflow and the permute needs several rounds
+    std::vector<std::uint32_t> v = random_kmers<std::uint32_t>(1000000, 25, 50);
+    for (size_t i = 0; i < v.size(); i += 4)
+        if (!(v[i] & high_bit<std::uint32_t>))
+            v[i] &= 0x3FFF;
+    for (unsigned nt : { 2, 3, 8 })
+        check_sort(v, 25, nt);
+}
+
+TEST(radixsort_test, threads_narrow) {
+    check_sort(random_kmers<std::uint32_t>(1000000, 9, 50), 9, 4);
+}
+
+} // namespace
+  // vim: sts=4:sw=4:ai:si:et
@@ -17,6 +17,7 @@
  */
 
 #include <fstream>
+#include <sstream>
 #include <gtest/gtest.h>
 #include "seqreader.h"
 
@@ -98,5 +99,83 @@ TEST(seqreader_test, read_gzipped) {
 }
 
 
+TEST(seqreader_test, chunk_fasta) {
+
+    std::istringstream f(">1 Long\nACGTAC\nGTACGT\nACG\n>2 Short\nTT\n");
+    sequence_reader r(f, sequence_reader::fasta);
+    r.set_chunking(5, 2);
+    sequence s;
+
+    EXPECT_TRUE(r.next(s));
+    EXPECT_EQ(std::string("1"), s.id);
+    EXPECT_EQ(std::string(">1 Long"), s.header);
+    EXPECT_EQ(std::string("ACGTAC"), s.data);
+    EXPECT_EQ(0, s.offset);
+    EXPECT_TRUE(r.next(s));
+    EXPECT_EQ(std::string("1"), s.id);
+    EXPECT_EQ(std::string(">1 Long"), s.header);
+    EXPECT_EQ(std::string("ACGTACGT"), s.data);
+    EXPECT_EQ(4, s.offset);
+    EXPECT_TRUE(r.next(s));
+    EXPECT_EQ(std::string("1"), s.id);
+    EXPECT_EQ(std::string("GTACG"), s.data);
+    EXPECT_EQ(10, s.offset);
+    EXPECT_TRUE(r.next(s));
+    EXPECT_EQ(std::string("2"), s.id);
+    EXPECT_EQ(std::string("TT"), s.data);
+    EXPECT_EQ(0, s.offset);
+    EXPECT_FALSE(r.next(s));
+}
+
+TEST(seqreader_test, chunk_bare) {
+
+    std::istringstream f("ACGTAC\nGTACGT\n");
+    sequence_reader r(f, sequence_reader::bare);
+    r.set_chunking(5, 2);
+    sequence s;
+
+    EXPECT_TRUE(r.next(s));
+    EXPECT_EQ(std::string("(anonymous)"), s.id);
+    EXPECT_EQ(std::string("ACGTAC"), s.data);
+    EXPECT_EQ(0, s.offset);
+    EXPECT_TRUE(r.next(s));
+    EXPECT_EQ(std::string("(anonymous)"), s.id);
+    EXPECT_EQ(std::string("ACGTACGT"), s.data);
+    EXPECT_EQ(4, s.offset);
+    EXPECT_FALSE(r.next(s));
+}
+
+TEST(seqreader_test, chunk_bad_overlap) {
+
+    std::istringstream f("ACGT\n");
+    sequence_reader r(f, sequence_reader::bare);
+    EXPECT_DEATH(r.set_chunking(4, 4), ".*");
+}
+
+TEST(seqreader_test, packed_fasta) {
+
+    std::istringstream f(">1 Long\nACGTAC\nGTANNT\nACG\n>2 Short\nTT\n");
+    sequence_reader r(f, sequence_reader::fasta);
+    r.set_chunking(5, 2);
+    r.set_packing(true);
+    sequence s;
+
+    EXPECT_TRUE(r.next(s));
+    EXPECT_EQ(std::string("acgtac"), s.packed.unpack());
+    EXPECT_TRUE(s.data.empty());
+    EXPECT_TRUE(r.next(s));
+    EXPECT_EQ(std::string("acgtannt"), s.packed.unpack());
+    EXPECT_EQ(4, s.offset);
+    ASSERT_EQ(1, s.packed.invalid.size());
+    EXPECT_EQ(5, s.packed.invalid[0].pos);
+    EXPECT_EQ(2, s.packed.invalid[0].len);
+    EXPECT_TRUE(r.next(s));
+    EXPECT_EQ(std::string("ntacg"), s.packed.unpack());
+    EXPECT_TRUE(r.next(s));
+    EXPECT_EQ(std::string("2"), s.id);
+    EXPECT_EQ(std::string("tt"), s.packed.unpack());
+    EXPECT_FALSE(r.next(s));
+}
+
 } // namespace
 // vim: sts=4:sw=4:ai:si:et
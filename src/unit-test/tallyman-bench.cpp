@@ -0,0 +1,117 @@
+/* tallyman-bench.cpp
+ * 
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Microbenchmark of the prefetching in the counting engine (countengine.h),
+// which prefetches the cells of the k-mers it is about to tally when these
+// cells do not fit in cache.  For k from 11 to 15 (single-stranded for even
+// k), it counts random DNA with each large-vector tallyman the engine is
+// used with, once as is, and once with prefetches() turned off.  Only the
+// counting is timed, after a first pass that has paged in the cells.
+//
+// Build and run with 'make bench'.
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include "countengine.h"
+
+using namespace kfc;
+
+namespace {
+
+typedef std::uint32_t u32;
+
+const size_t n_bases = 1UL << 25;
+
+// no_prefetch - the tallyman, but tallied by the engine without prefetching
+
+template <typename tman_t>
+struct no_prefetch : tman_t
+{
+    no_prefetch(int nbits) : tman_t(nbits) { }
+    bool prefetches() const { return false; }
+};
+
+packed_dna
+random_dna()
+{
+    std::string s(n_bases, 'a');
+    std::uint64_t seed = 42;
+    for (auto& b : s) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        b = "acgt"[seed >> 62];
+    }
+
+    packed_dna d;
+    d.assign(s.data(), s.size());
+    return d;
+}
+
+// returns the Mbases per second counted, on the second of two passes
+
+template <typename tman_t>
+double
+count(int k, const packed_dna& dna, unsigned n_threads = 1)
+{
+    bool ss = !(k % 2);
+    std::unique_ptr<kmer_counter> e(make_engine<u32>(new tman_t(2*k - !ss), k, ss, n_threads));
+
+    e->process(dna);
+
+    auto t0 = std::chrono::steady_clock::now();
+    e->process(dna);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    return n_bases / secs / 1e6;
+}
+
+template <typename tman_t>
+void
+compare(const char *name, int k, const packed_dna& dna, unsigned n_threads = 1)
+{
+    double off = count<no_prefetch<tman_t>>(k, dna, n_threads);
+    double on = count<tman_t>(k, dna, n_threads);
+    std::printf("  %-10s %6.1f %6.1f  %5.2f", name, off, on, on / off);
+}
+
+} // namespace
+
+int
+main()
+{
+    set_verbose(false);
+
+    packed_dna dna = random_dna();
+
+    std::printf("prefetch distance %lu, Mbases/s without and with prefetch\n",
+            static_cast<unsigned long>(tally_prefetch_distance));
+
+    for (int k = 11; k <= 15; ++k) {
+        std::printf("k=%d", k);
+        compare<tallyman_vec<u32,u32>>("vector", k, dna);
+        compare<tallyman_vec_atomic<u32,u32>>("atomic", k, dna, 2);
+        compare<tallyman_vec_compact<u32,u32>>("compact", k, dna);
+        compare<tallyman_bits<u32,u32,2>>("2-bit", k, dna);
+        std::printf("\n");
+    }
+
+    return 0;
+}
+
+// vim: sts=4:sw=4:ai:si:et
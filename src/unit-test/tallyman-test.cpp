@@ -17,9 +17,11 @@
  */
 
 #include <list>
+#include <thread>
 #include <gtest/gtest.h>
 #include "tallyman.h"
 #include "utils.h"
+#include "testutils.h"
 
 using namespace kfc;
 
@@ -42,11 +44,33 @@ typedef tallyman_vec<std::uint64_t,std::uint32_t> tvec6432;
 typedef tallyman_vec<std::uint32_t,std::uint64_t> tvec3264;
 typedef tallyman_vec<std::uint64_t,std::uint64_t> tvec6464;
 
+typedef tallyman_vec_atomic<std::uint32_t,std::uint32_t> tatom3232;
+typedef tallyman_vec_atomic<std::uint64_t,std::uint64_t> tatom6464;
+
+typedef tallyman_vec_private<std::uint32_t,std::uint32_t> tpriv3232;
+typedef tallyman_vec_private<std::uint64_t,std::uint64_t> tpriv6464;
+
+typedef tallyman_vec_blocked<std::uint32_t,std::uint32_t> tblock3232;
+typedef tallyman_vec_blocked<std::uint64_t,std::uint64_t> tblock6464;
+
+typedef tallyman_vec_compact<std::uint32_t,std::uint32_t> tcomp3232;
+typedef tallyman_vec_compact<std::uint64_t,std::uint64_t,std::uint16_t> tcomp6464w;
+
+typedef tallyman_bits<std::uint32_t,std::uint32_t,1> tbit3232;
+typedef tallyman_bits<std::uint32_t,std::uint32_t,2> tsat3232;
+typedef tallyman_bits<std::uint64_t,std::uint32_t,2> tsat6432;
+
 typedef tallyman_map<std::uint32_t,std::uint32_t> tmap3232;
 typedef tallyman_map<std::uint32_t,std::uint64_t> tmap3264;
 typedef tallyman_map<std::uint64_t,std::uint32_t> tmap6432;
 typedef tallyman_map<std::uint64_t,std::uint64_t> tmap6464;
 
+typedef tallyman_map_sharded<std::uint32_t,std::uint32_t> tshard3232;
+typedef tallyman_map_sharded<std::uint64_t,std::uint32_t> tshard6432;
+
+typedef tallyman_hash<std::uint32_t,std::uint32_t> thash3232;
+typedef tallyman_hash<std::uint64_t,std::uint32_t> thash6432;
+
 typedef std::map<std::uint32_t,std::uint32_t> map3232;
 typedef std::map<std::uint64_t,std::uint32_t> map6432;
 
@@ -141,6 +165,25 @@ TEST(tallyman_test, store_two_ones) {
     EXPECT_EQ(v[1], 2);
 }
 
+TEST(tallyman_test, store_range) {
+    std::vector<std::uint32_t> v { 1, 2, 2, 3, 9 };
+    for (bool map : { false, true }) {
+        uptr3232 t = create_uptr3232(3, map);
+        t->tally(v.data() + 1, v.data() + v.size());
+        t->tally(v.data(), v.data());
+        EXPECT_EQ(t->invalid_count(), 1);
+        if (map) {
+            EXPECT_EQ(t->get_results_map().size(), 2);
+            EXPECT_EQ(t->get_results_map().at(2), 2);
+        }
+        else {
+            EXPECT_EQ(t->get_results_vec()[1], 0);
+            EXPECT_EQ(t->get_results_vec()[2], 2);
+            EXPECT_EQ(t->get_results_vec()[3], 1);
+        }
+    }
+}
+
 TEST(tallyman_test, store_invalid) {
     uptr3232 r = create_uptr3232(2);
     r->tally({4,3});
@@ -212,5 +255,454 @@ TEST(tallyman_test, store_map_invalid_64) {
     EXPECT_EQ(++i, m.cend());
 }
 
+TEST(tallyman_test, atomic_is_vec) {
+    uptr3232 r(new tatom3232(4));
+    EXPECT_TRUE(r->is_vec());
+    EXPECT_TRUE(r->is_concurrent());
+    EXPECT_FALSE(r->is_map());
+}
+
+TEST(tallyman_test, vec_map_not_concurrent) {
+    EXPECT_FALSE(create_uptr3232(4)->is_concurrent());
+    EXPECT_FALSE(create_uptr3232(4,true)->is_concurrent());
+}
+
+TEST(tallyman_test, atomic_store_invalid) {
+    uptr3232 r(new tatom3232(2));
+    r->tally({4,3,3,7});
+    EXPECT_EQ(r->invalid_count(),2);
+    const uint32_t* v = r->get_results_vec();
+    EXPECT_EQ(v[3], 2);
+    EXPECT_EQ(v[0], 0);
+}
+
+TEST(tallyman_test, atomic_store_64) {
+    uptr6464 r(new tatom6464(4));
+    r->tally({15, 16, std::uint64_t(1)<<40});
+    EXPECT_EQ(r->invalid_count(),2);
+    EXPECT_EQ(r->get_results_vec()[15], 1);
+}
+
+TEST(tallyman_test, atomic_threads) {
+    const int n_threads = 8;
+    const int n_rounds = 1000;
+
+    tatom3232 t(4);
+    std::vector<std::uint32_t> items;
+    for (std::uint32_t i = 0; i < 20; ++i)
+        items.push_back(i);     // 16 valid, 4 invalid
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n_threads; ++i)
+        threads.emplace_back([&t, &items] {
+            for (int j = 0; j < n_rounds; ++j)
+                t.tally(items);
+        });
+    for (auto& th : threads)
+        th.join();
+
+    EXPECT_EQ(t.invalid_count(), 4 * n_threads * n_rounds);
+    for (int i = 0; i < 16; ++i)
+        EXPECT_EQ(t.get_results_vec()[i], n_threads * n_rounds);
+}
+
+TEST(tallyman_test, private_is_vec) {
+    uptr3232 r(new tpriv3232(4, 2));
+    EXPECT_TRUE(r->is_vec());
+    EXPECT_TRUE(r->is_concurrent());
+    EXPECT_FALSE(r->is_map());
+}
+
+TEST(tallyman_test, private_store_invalid) {
+    uptr3232 r(new tpriv3232(2, 2));
+    r->tally({4,3,3,7});
+    r->finish();
+    EXPECT_EQ(r->invalid_count(),2);
+    const uint32_t* v = r->get_results_vec();
+    EXPECT_EQ(v[3], 2);
+    EXPECT_EQ(v[0], 0);
+}
+
+TEST(tallyman_test, private_store_64) {
+    uptr6464 r(new tpriv6464(4, 1));
+    r->tally({15, 16, std::uint64_t(1)<<40});
+    r->finish();
+    EXPECT_EQ(r->invalid_count(),2);
+    EXPECT_EQ(r->get_results_vec()[15], 1);
+}
+
+TEST(tallyman_test, private_finish_twice) {
+    uptr3232 r(new tpriv3232(4, 2));
+    std::thread t([&r] { r->tally({1,2,2,99}); });
+    t.join();
+    r->tally({2,99});
+    r->finish();
+    r->finish();
+    EXPECT_EQ(r->invalid_count(),2);
+    EXPECT_EQ(r->get_results_vec()[1], 1);
+    EXPECT_EQ(r->get_results_vec()[2], 3);
+}
+
+TEST(tallyman_test, private_threads) {
+    const int n_threads = 8;
+    const int n_rounds = 100;
+    const int n_bits = 18;      // large enough for a parallel reduction
+
+    tpriv3232 t(n_bits, 4);
+    std::vector<std::uint32_t> items;
+    for (std::uint32_t i = 0; i < (1U << n_bits) + 7; i += 7)
+        items.push_back(i);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n_threads; ++i)
+        threads.emplace_back([&t, &items] {
+            for (int j = 0; j < n_rounds; ++j)
+                t.tally(items);
+        });
+    for (auto& th : threads)
+        th.join();
+
+    t.finish();
+
+    EXPECT_EQ(t.invalid_count(), n_threads * n_rounds);
+    const std::uint32_t *v = t.get_results_vec();
+    for (std::uint32_t i = 0; i < (1U << n_bits); ++i)
+        if (v[i] != (i % 7 ? 0 : n_threads * n_rounds)) {
+            ADD_FAILURE() << "wrong count at " << i << ": " << v[i];
+            break;
+        }
+}
+
+TEST(tallyman_test, blocked_is_vec) {
+    uptr3232 r(new tblock3232(4));
+    EXPECT_TRUE(r->is_vec());
+    EXPECT_FALSE(r->is_concurrent());
+    EXPECT_FALSE(r->is_map());
+}
+
+TEST(tallyman_test, blocked_part_bits) {
+    EXPECT_EQ(tblock3232(16).part_bits(), 0);
+    EXPECT_EQ(tblock3232(17).part_bits(), 1);
+    EXPECT_EQ(tblock3232(24).part_bits(), 8);
+    EXPECT_EQ(tblock3232(32).part_bits(), 10);
+}
+
+TEST(tallyman_test, blocked_store_invalid) {
+    uptr6464 r(new tblock6464(4));
+    r->tally({15, 16, std::uint64_t(1)<<40, 15});
+    r->finish();
+    EXPECT_EQ(r->invalid_count(),2);
+    EXPECT_EQ(r->get_results_vec()[15], 2);
+}
+
+TEST(tallyman_test, blocked_agrees_with_vec) {
+
+    // enough items to fill and flush the buffers many times, tallied
+    // through both tally() and sink(), with a finish() in between
+
+    tblock3232 b(22);
+    tvec3232 v(22);
+
+    std::vector<std::uint32_t> items;
+    test_lcg rng(7);
+    for (int i = 0; i != 3000000; ++i)
+        items.push_back((rng() >> 4) & 0x7FFFFF);
+
+    size_t half = items.size() / 2;
+    b.tally(items.data(), items.data() + half);
+    b.finish();
+
+    tblock3232::sink_t sink = b.sink();
+    for (size_t i = half; i != items.size(); ++i)
+        if (items[i] <= b.max_value())
+            sink(items[i]);
+        else
+            b.add_invalid(1);
+    b.finish();
+
+    v.tally(items);
+
+    EXPECT_EQ(b.invalid_count(), v.invalid_count());
+    const std::uint32_t *rb = b.get_results_vec(), *rv = v.get_results_vec();
+    for (size_t i = 0; i != (1UL << 22); ++i)
+        ASSERT_EQ(rb[i], rv[i]);
+}
+
+TEST(tallyman_test, sharded_is_map) {
+    uptr3232 r(new tshard3232(8, 2));
+    EXPECT_TRUE(r->is_map());
+    EXPECT_TRUE(r->is_concurrent());
+    EXPECT_FALSE(r->is_vec());
+    EXPECT_EQ(r->map_shards(), 4);
+}
+
+TEST(tallyman_test, sharded_max_bits) {
+    uptr3232 r(new tshard3232(3, 6));
+    EXPECT_EQ(r->map_shards(), 8);
+    r->tally({0,7,8});
+    EXPECT_EQ(r->invalid_count(),1);
+    EXPECT_EQ(r->get_results_shard(7).at(7), 1);
+}
+
+TEST(tallyman_test, sharded_no_results_map) {
+    uptr3232 r(new tshard3232(8, 2));
+    EXPECT_DEATH(r->get_results_map(), ".*");
+    EXPECT_DEATH(r->get_results_vec(), ".*");
+}
+
+TEST(tallyman_test, sharded_single_shard) {
+    uptr3232 r(new tshard3232(8, 0));
+    r->tally({3,3});
+    EXPECT_EQ(r->get_results_map().at(3), 2);
+}
+
+TEST(tallyman_test, sharded_store_in_order) {
+    uptr6432 r(new tshard6432(63, 3));
+    r->tally({~std::uint64_t(0)>>1, 0, 1, std::uint64_t(1)<<61, 1});
+    EXPECT_EQ(r->invalid_count(),0);
+    EXPECT_EQ(r->map_shards(), 8);
+
+    std::vector<std::pair<std::uint64_t,std::uint32_t>> all;
+    for (unsigned n = 0; n != r->map_shards(); ++n)
+        for (auto& e : r->get_results_shard(n))
+            all.push_back(e);
+
+    ASSERT_EQ(all.size(), 4);
+    EXPECT_EQ(all[0].first, 0);
+    EXPECT_EQ(all[1].first, 1);
+    EXPECT_EQ(all[1].second, 2);
+    EXPECT_EQ(all[2].first, std::uint64_t(1)<<61);
+    EXPECT_EQ(all[3].first, ~std::uint64_t(0)>>1);
+}
+
+TEST(tallyman_test, sharded_threads) {
+    const int n_threads = 8;
+    const int n_rounds = 200;
+
+    tshard3232 t(10, 4);
+    std::vector<std::uint32_t> items;
+    for (std::uint32_t i = 0; i < 1100; i += 3)
+        items.push_back(i);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n_threads; ++i)
+        threads.emplace_back([&t, &items] {
+            for (int j = 0; j < n_rounds; ++j)
+                t.tally(items);
+        });
+    for (auto& th : threads)
+        th.join();
+
+    EXPECT_EQ(t.invalid_count(), 25 * n_threads * n_rounds);
+
+    std::uint32_t expect = 0;
+    for (unsigned n = 0; n != t.map_shards(); ++n)
+        for (auto& e : t.get_results_shard(n)) {
+            EXPECT_EQ(e.first, expect);
+            EXPECT_EQ(e.second, n_threads * n_rounds);
+            expect += 3;
+        }
+    EXPECT_EQ(expect, 1026);
+}
+
+TEST(tallyman_test, hash_is_hash) {
+    uptr3232 r(new thash3232(20));
+    EXPECT_TRUE(r->is_hash());
+    EXPECT_FALSE(r->is_map());
+    EXPECT_FALSE(r->is_vec());
+    EXPECT_FALSE(r->is_concurrent());
+    EXPECT_DEATH(r->get_results_map(), ".*");
+}
+
+TEST(tallyman_test, hash_store_none) {
+    uptr3232 r(new thash3232(20));
+    r->finish();
+    size_t n = 1;
+    r->get_results_hash(n);
+    EXPECT_EQ(n, 0);
+}
+
+TEST(tallyman_test, hash_store_invalid) {
+    uptr6432 r(new thash6432(29));
+    r->tally({std::uint64_t(1)<<29, (std::uint64_t(1)<<29)-1, 7, (std::uint64_t(1)<<29)-1});
+    r->finish();
+    EXPECT_EQ(r->invalid_count(), 1);
+    size_t n = 0;
+    const thash6432::entry *e = r->get_results_hash(n);
+    ASSERT_EQ(n, 2);
+    EXPECT_EQ(e[0].value, 7);
+    EXPECT_EQ(e[0].count, 1);
+    EXPECT_EQ(e[1].value, (std::uint64_t(1)<<29)-1);
+    EXPECT_EQ(e[1].count, 2);
+}
+
+TEST(tallyman_test, hash_all_ones_value) {
+    uptr3232 r(new thash3232(32));
+    r->tally({~std::uint32_t(0), 0, ~std::uint32_t(0)});
+    r->finish();
+    r->finish();
+    EXPECT_EQ(r->invalid_count(), 0);
+    size_t n = 0;
+    const thash3232::entry *e = r->get_results_hash(n);
+    ASSERT_EQ(n, 2);
+    EXPECT_EQ(e[0].value, 0);
+    EXPECT_EQ(e[1].value, ~std::uint32_t(0));
+    EXPECT_EQ(e[1].count, 2);
+}
+
+TEST(tallyman_test, hash_grows_and_agrees_with_map) {
+
+    // enough distinct values to grow the table several times
+
+    thash3232 h(24, 100);
+    tmap3232 m(24);
+
+    std::vector<std::uint32_t> items;
+    test_lcg rng(3);
+    for (int i = 0; i != 50000; ++i)
+        items.push_back((rng() >> 4) & 0x1FFFFFF);
+
+    h.tally(items);
+    m.tally(items);
+    h.finish();
+
+    EXPECT_EQ(h.invalid_count(), m.invalid_count());
+
+    size_t n = 0;
+    const thash3232::entry *e = h.get_results_hash(n);
+    ASSERT_EQ(n, m.get_results_map().size());
+    for (const auto& kv : m.get_results_map()) {
+        ASSERT_EQ(e->value, kv.first);
+        ASSERT_EQ(e->count, kv.second);
+        ++e;
+    }
+
+    EXPECT_DEATH(h.tally(items), ".*");
+}
+
+TEST(tallyman_test, hash_table_bytes) {
+    EXPECT_EQ(thash3232::table_bytes(0), 8 * 1536);
+    EXPECT_EQ(thash3232::table_bytes(716), 8 * 1536);
+    EXPECT_EQ(thash3232::table_bytes(717), 8 * 3072);
+    EXPECT_EQ(thash6432::table_bytes(717), 16 * 3072);
+}
+
+TEST(tallyman_test, compact_is_compact) {
+    uptr3232 r(new tcomp3232(4));
+    EXPECT_TRUE(r->is_compact());
+    EXPECT_FALSE(r->is_vec());
+    EXPECT_FALSE(r->is_concurrent());
+    EXPECT_DEATH(r->get_results_vec(), ".*");
+}
+
+TEST(tallyman_test, no_range_on_vec) {
+    uptr3232 r(new tvec3232(4));
+    std::uint32_t out[2];
+    EXPECT_DEATH(r->get_results_range(0, 2, out), ".*");
+}
+
+TEST(tallyman_test, compact_store_invalid) {
+    uptr3232 r(new tcomp3232(2));
+    r->tally({4,3,3,7});
+    r->finish();
+    EXPECT_EQ(r->invalid_count(),2);
+    std::uint32_t out[4];
+    r->get_results_range(0, 4, out);
+    EXPECT_EQ(out[3], 2);
+    EXPECT_EQ(out[0], 0);
+}
+
+TEST(tallyman_test, compact_overflows) {
+    tcomp3232 t(8);
+    t.tally(std::vector<std::uint32_t>(1000, 200));
+    t.tally(std::vector<std::uint32_t>(255, 7));
+    t.tally(std::vector<std::uint32_t>(256, 255));
+
+    tcomp3232::sink_t sink = t.sink();
+    for (int i = 0; i != 300; ++i)
+        sink(0);
+
+    t.finish();
+    EXPECT_EQ(t.overflow_size(), 3);
+
+    std::uint32_t out[256];
+    t.get_results_range(0, 256, out);
+    EXPECT_EQ(out[0], 300);
+    EXPECT_EQ(out[7], 255);
+    EXPECT_EQ(out[200], 1000);
+    EXPECT_EQ(out[255], 256);
+    EXPECT_EQ(out[1], 0);
+
+    // a range that starts past some of the overflowed values
+
+    t.get_results_range(200, 56, out);
+    EXPECT_EQ(out[0], 1000);
+    EXPECT_EQ(out[55], 256);
+    EXPECT_EQ(out[1], 0);
+
+    // the overflow is finished, so a value that overflows is refused
+
+    EXPECT_DEATH(t.tally({0}), ".*");
+}
+
+TEST(tallyman_test, compact_wide_cells_64) {
+    tcomp6464w t(20);
+    std::uint64_t big = (std::uint64_t(1) << 20) - 1;
+    t.tally(std::vector<std::uint64_t>(70000, big));
+    t.tally({5, std::uint64_t(1) << 40});
+    t.finish();
+    EXPECT_EQ(t.invalid_count(), 1);
+    EXPECT_EQ(t.overflow_size(), 1);
+
+    std::uint64_t out[2];
+    t.get_results_range(big - 1, 2, out);
+    EXPECT_EQ(out[0], 0);
+    EXPECT_EQ(out[1], 70000);
+}
+
+TEST(tallyman_test, bits_is_compact) {
+    uptr3232 r(new tbit3232(4));
+    EXPECT_TRUE(r->is_compact());
+    EXPECT_FALSE(r->is_vec());
+    EXPECT_DEATH(r->get_results_map(), ".*");
+}
+
+TEST(tallyman_test, bits_presence) {
+    tbit3232 t(7);
+    t.tally({0, 63, 64, 64, 127, 128, 5});
+    std::uint32_t out[128];
+    t.get_results_range(0, 128, out);
+    EXPECT_EQ(t.invalid_count(), 1);
+    EXPECT_EQ(out[0], 1);
+    EXPECT_EQ(out[1], 0);
+    EXPECT_EQ(out[63], 1);
+    EXPECT_EQ(out[64], 1);
+    EXPECT_EQ(out[127], 1);
+    EXPECT_EQ(std::count(out, out + 128, 1U), 5);
+}
+
+TEST(tallyman_test, bits_saturate) {
+    tsat3232 t(6);
+    tsat3232::sink_t sink = t.sink();
+    for (std::uint32_t i = 0; i != 64; ++i)
+        for (std::uint32_t n = 0; n != i % 6; ++n)
+            sink(i);
+    std::uint32_t out[60];
+    t.get_results_range(4, 60, out);
+    for (std::uint32_t i = 4; i != 64; ++i)
+        ASSERT_EQ(out[i-4], std::min(i % 6, 3U));
+}
+
+TEST(tallyman_test, bits_saturate_64) {
+    tsat6432 t(33);
+    std::uint64_t big = (std::uint64_t(1) << 33) - 1;
+    t.tally({big, big, 7, big + 1});
+    std::uint32_t out[2];
+    t.get_results_range(big - 1, 2, out);
+    EXPECT_EQ(out[0], 0);
+    EXPECT_EQ(out[1], 2);
+    EXPECT_EQ(t.invalid_count(), 1);
+}
+
 } // namespace
 // vim: sts=4:sw=4:ai:si:et
@@ -0,0 +1,103 @@
+/* taskpool-test.cpp
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <gtest/gtest.h>
+#include "taskpool.h"
+
+using namespace kfc;
+
+namespace {
+
+TEST(taskpool_test, no_capacity_zero) {
+    EXPECT_DEATH(task_pool<int>(2, 0, [](int&) { }), ".*");
+}
+
+TEST(taskpool_test, zero_threads_is_one) {
+    task_pool<int> p(0, 1, [](int&) { });
+    EXPECT_EQ(p.n_threads(), 1);
+}
+
+TEST(taskpool_test, runs_all_tasks) {
+    const int n_tasks = 10000;
+    std::atomic<long> sum(0);
+
+    task_pool<int> p(4, 3, [&sum](int& i) { sum += i; });
+    for (int i = 1; i <= n_tasks; ++i)
+        p.submit(std::move(i));
+    p.finish();
+
+    EXPECT_EQ(sum.load(), (long)n_tasks * (n_tasks + 1) / 2);
+
+    size_t n_run = 0;
+    for (unsigned i = 0; i != p.n_threads(); ++i)
+        n_run += p.stats(i).n_tasks;
+    EXPECT_EQ(n_run, n_tasks);
+}
+
+TEST(taskpool_test, finish_twice) {
+    std::atomic<int> n(0);
+    task_pool<int> p(2, 4, [&n](int&) { ++n; });
+    p.submit(1);
+    p.finish();
+    p.finish();
+    EXPECT_EQ(n.load(), 1);
+}
+
+TEST(taskpool_test, no_submit_after_finish) {
+    task_pool<int> p(2, 4, [](int&) { });
+    p.finish();
+    EXPECT_DEATH(p.submit(1), ".*");
+}
+
+TEST(taskpool_test, move_only) {
+    int got = 0;
+    task_pool<std::unique_ptr<int>> p(1, 1, [&got](std::unique_ptr<int>& t) { got = *t; });
+    p.submit(std::unique_ptr<int>(new int(42)));
+    p.finish();
+    EXPECT_EQ(got, 42);
+}
+
+TEST(taskpool_test, idle_worker_steals) {
+
+    // the first task to run blocks its worker until all other tasks are
+    // done, so the other worker must steal the blocked worker's tasks
+
+    const int n_tasks = 12;
+    std::atomic<bool> first(true);
+    std::atomic<int> n_done(0);
+
+    task_pool<int> p(2, n_tasks, [&first, &n_done](int&) {
+        if (first.exchange(false))
+            while (n_done.load() < n_tasks - 1)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ++n_done;
+    });
+
+    for (int i = 0; i < n_tasks; ++i)
+        p.submit(std::move(i));
+    p.finish();
+
+    EXPECT_EQ(n_done.load(), n_tasks);
+    EXPECT_GT(p.stats(0).n_stolen + p.stats(1).n_stolen, 0);
+}
+
+} // namespace
+  // vim: sts=4:sw=4:ai:si:et
@@ -0,0 +1,58 @@
+/* testutils.h
+ *
+ * Copyright (C) 2019  Marco van Zwetselaar <io@zwets.it>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef testutils_h_INCLUDED
+#define testutils_h_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace kfc {
+
+// test_lcg - the linear congruential generator shared by the tests
+//
+// Cheap, and the same sequence on every platform, so a failing test can
+// be rerun with the same input.  Each call advances the state and returns
+// it; take the high bits, as the low bits have short periods.
+
+class test_lcg {
+    std::uint32_t state_;
+
+    public:
+        explicit test_lcg(std::uint32_t seed) : state_(seed) { }
+        std::uint32_t operator()() { return state_ = state_ * 1103515245 + 12345; }
+};
+
+// random_bases - string of n bases drawn uniformly from the given alphabet
+
+inline std::string
+random_bases(size_t n, std::uint32_t seed, const char* alphabet)
+{
+    test_lcg rng(seed);
+    size_t a = std::strlen(alphabet);
+
+    std::string s(n, 'a');
+    for (auto& b : s)
+        b = alphabet[(rng() >> 16) % a];
+    return s;
+}
+
+} // namespace kfc
+
+#endif // testutils_h_INCLUDED
+       // vim: sts=4:sw=4:ai:si:et